@@ -0,0 +1,149 @@
+#include "gimli/benchmark_testdata.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+#include "gimli/recording.pb.h"
+#include "gimli/report.h"
+#include "gimli/stderr_processor.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/text_format.h"
+#include "rules_cc/cc/runfiles/runfiles.h"
+
+namespace gimli {
+namespace {
+using ::google::devtools::build::v1::PublishBuildToolEventStreamRequest;
+using ::rules_cc::cc::runfiles::Runfiles;
+
+// Initialized by `main`, before any benchmark runs.
+std::unique_ptr<Runfiles> runfiles;
+
+Recording LoadRecorded() {
+  // This matches the name in MODULE.bazel
+  static const std::filesystem::path kProjectPath = "gimli";
+  const auto rlocation = runfiles->Rlocation(
+    kProjectPath / "gimli/testdata/non_fatal_error.textproto");
+  std::ifstream stream(rlocation);
+  CHECK(stream.is_open()) << "File not found " << rlocation
+                          << ", did your forget to add it to the `data` of "
+                             "the rule?";
+  const std::string data((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+
+  Recording recording;
+  CHECK(google::protobuf::TextFormat::ParseFromString(data, &recording));
+  return recording;
+}
+
+std::string LoadRecordedStderr() {
+  std::string stderr;
+  for (const auto& build_event : BenchmarkTestdata::Recorded().build_events()) {
+    if (build_event.has_progress()) {
+      absl::StrAppend(&stderr, build_event.progress().stderr());
+    }
+  }
+  return stderr;
+}
+
+}  // namespace
+
+const Recording& BenchmarkTestdata::Recorded() {
+  static const auto* const recording = new Recording(LoadRecorded());
+  return *recording;
+}
+
+std::vector<PublishBuildToolEventStreamRequest> BenchmarkTestdata::Requests(
+  int copies) {
+  const auto& recorded = Recorded().requests();
+  CHECK(!recorded.empty()) << "No request in the recording";
+
+  std::vector<PublishBuildToolEventStreamRequest> requests;
+  for (int i = 0; i < copies; ++i) {
+    for (int j = 0; j + 1 < recorded.size(); ++j) {
+      requests.push_back(recorded[j]);
+    }
+  }
+  requests.push_back(recorded[recorded.size() - 1]);
+  for (size_t i = 0; i < requests.size(); ++i) {
+    requests[i].mutable_ordered_build_event()->set_sequence_number(i + 1);
+  }
+  return requests;
+}
+
+const std::string& BenchmarkTestdata::RecordedStderr() {
+  static const auto* const stderr = new std::string(LoadRecordedStderr());
+  return *stderr;
+}
+
+std::string BenchmarkTestdata::Stderr(int copies) {
+  std::string stderr;
+  for (int i = 0; i < copies; ++i) {
+    absl::StrAppend(&stderr, RecordedStderr());
+  }
+  return stderr;
+}
+
+std::string BenchmarkTestdata::AnsiHeavyStderr(int copies) {
+  StderrProcessor processor;
+  StderrProcessor::Contents contents;
+  processor.ToContents(RecordedStderr(), contents);
+
+  std::string colored;
+  int color = 0;
+  for (std::string_view line : contents.lines()) {
+    for (std::string_view word : absl::StrSplit(line, ' ')) {
+      absl::StrAppend(&colored, "\033[1;3", color, "m", word, "\033[0m ");
+      color = (color + 1) % 8;
+    }
+    absl::StrAppend(&colored, "\r\n");
+  }
+
+  std::string stderr;
+  for (int i = 0; i < copies; ++i) {
+    absl::StrAppend(&stderr, colored);
+  }
+  return stderr;
+}
+
+Report BenchmarkTestdata::MakeReport(std::filesystem::path workspace_path,
+                                     int errors) {
+  const auto recorded_errors = StderrProcessor().ToErrors(RecordedStderr());
+  CHECK(!recorded_errors.empty()) << "No error in the recorded stderr";
+
+  Report report{.workspace_path = std::move(workspace_path)};
+  report.errors.reserve(errors);
+  auto error = recorded_errors.front();
+  for (int i = 0; i < errors; ++i) {
+    error.line = i + 1;
+    report.errors.push_back(error);
+  }
+  return report;
+}
+
+}  // namespace gimli
+
+int main(int argc, char** argv) {
+  std::string error;
+  gimli::runfiles.reset(
+    ::rules_cc::cc::runfiles::Runfiles::Create(argv[0], &error));
+  if (gimli::runfiles == nullptr) {
+    LOG(ERROR) << "Cannot find runfiles: " << error;
+    return 1;
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef _GIMLI_BENCHMARK_TESTDATA_H_
+#define _GIMLI_BENCHMARK_TESTDATA_H_
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "gimli/recording.pb.h"
+#include "gimli/report.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+
+namespace gimli {
+
+// Deterministic inputs for benchmarks, derived from the recording
+// `gimli/testdata/non_fatal_error.textproto`, which must be in the `data` of
+// the benchmark. This library also provides the `main` of the benchmark.
+struct BenchmarkTestdata {
+  // The recording, parsed once.
+  static const Recording& Recorded();
+  // The recorded requests, with all but the last one repeated `copies` times
+  // and renumbered, like a build with `copies` times more events.
+  static std::vector<
+    google::devtools::build::v1::PublishBuildToolEventStreamRequest>
+  Requests(int copies);
+  // The stderr of all the progress events of the recording, concatenated.
+  static const std::string& RecordedStderr();
+  // The recorded stderr, repeated `copies` times.
+  static std::string Stderr(int copies);
+  // The recorded stderr without its ANSI codes, repeated `copies` times, with
+  // each word in a different color, like heavily colored outputs.
+  static std::string AnsiHeavyStderr(int copies);
+  // A report with `errors` copies of the first recorded error, on successive
+  // lines.
+  static Report MakeReport(std::filesystem::path workspace_path, int errors);
+};
+
+}  // namespace gimli
+
+#endif  // _GIMLI_BENCHMARK_TESTDATA_H_
@@ -0,0 +1,125 @@
+#include "gimli/build_event_decoder.h"
+
+#include <cstdint>
+#include <string_view>
+
+#include "google/protobuf/any.pb.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+namespace {
+using ::build_event_stream::BuildEvent;
+using ::build_event_stream::BuildStarted;
+using ::build_event_stream::Progress;
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::internal::WireFormatLite;
+
+CodedInputStream InputOf(std::string_view bytes) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return CodedInputStream(reinterpret_cast<const uint8_t*>(bytes.data()),
+                          static_cast<int>(bytes.size()));
+}
+
+// Reads the value of the length-delimited field whose tag was just read from
+// `input`, which reads `bytes`, as a view into `bytes`.
+bool ReadView(CodedInputStream& input, std::string_view bytes,
+              std::string_view& view) {
+  if (uint32_t length; input.ReadVarint32(&length)) {
+    const auto position = static_cast<size_t>(input.CurrentPosition());
+    if (length > bytes.size() - position) return false;
+    view = bytes.substr(position, length);
+    return input.Skip(static_cast<int>(length));
+  }
+  return false;
+}
+
+bool IsLengthDelimited(uint32_t tag) {
+  return WireFormatLite::GetTagWireType(tag) ==
+         WireFormatLite::WIRETYPE_LENGTH_DELIMITED;
+}
+
+bool DecodeStarted(std::string_view bytes, BuildEventDecoder::Event& event) {
+  auto input = InputOf(bytes);
+  while (const uint32_t tag = input.ReadTag()) {
+    const int number = WireFormatLite::GetTagFieldNumber(tag);
+    if (number == BuildStarted::kWorkspaceDirectoryFieldNumber &&
+        IsLengthDelimited(tag)) {
+      if (!ReadView(input, bytes, event.workspace_directory)) return false;
+    } else if (number == BuildStarted::kStartTimeFieldNumber &&
+               IsLengthDelimited(tag)) {
+      std::string_view start_time;
+      if (!ReadView(input, bytes, start_time) ||
+          !event.start_time.ParseFromArray(
+            start_time.data(), static_cast<int>(start_time.size()))) {
+        return false;
+      }
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+bool DecodeProgress(std::string_view bytes, BuildEventDecoder::Event& event) {
+  auto input = InputOf(bytes);
+  while (const uint32_t tag = input.ReadTag()) {
+    if (WireFormatLite::GetTagFieldNumber(tag) ==
+          Progress::kStderrFieldNumber &&
+        IsLengthDelimited(tag)) {
+      if (!ReadView(input, bytes, event.stderr)) return false;
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+// Whether the field `number` of build events is one of the payloads, which
+// are all in the same oneof.
+bool IsPayload(int number) {
+  const auto* field = BuildEvent::descriptor()->FindFieldByNumber(number);
+  return field != nullptr && field->containing_oneof() != nullptr;
+}
+
+}  // namespace
+
+bool BuildEventDecoder::Decode(const google::protobuf::Any& bazel_event,
+                               Event& event) const {
+  if (!bazel_event.Is<BuildEvent>()) return false;
+  event = {};
+  const std::string_view bytes = bazel_event.value();
+  auto input = InputOf(bytes);
+  while (const uint32_t tag = input.ReadTag()) {
+    const int number = WireFormatLite::GetTagFieldNumber(tag);
+    if (!IsPayload(number)) {
+      if (!WireFormatLite::SkipField(&input, tag)) return false;
+      continue;
+    }
+    // Oneof cases have the number of their field.
+    event.payload_case = static_cast<BuildEvent::PayloadCase>(number);
+    std::string_view payload;
+    switch (number) {
+      case BuildEvent::kStartedFieldNumber:
+        if (!IsLengthDelimited(tag) || !ReadView(input, bytes, payload)) {
+          return false;
+        }
+        if (!DecodeStarted(payload, event)) return false;
+        break;
+      case BuildEvent::kProgressFieldNumber:
+        if (!IsLengthDelimited(tag) || !ReadView(input, bytes, payload)) {
+          return false;
+        }
+        if (!DecodeProgress(payload, event)) return false;
+        break;
+      default:
+        // The payload is not used, so the rest of the event is not read.
+        return true;
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+}  // namespace gimli
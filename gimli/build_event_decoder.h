@@ -0,0 +1,36 @@
+#ifndef GIMLI_BUILD_EVENT_DECODER_H_
+#define GIMLI_BUILD_EVENT_DECODER_H_
+
+#include <string_view>
+
+#include "google/protobuf/any.pb.h"
+#include "google/protobuf/timestamp.pb.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+
+// Decodes the few fields of build events that gimli uses, straight from their
+// wire format. Most events have a payload gimli doesn't use, and are skipped
+// as soon as their payload is known, without parsing it.
+class BuildEventDecoder {
+ public:
+  // The used parts of a `build_event_stream::BuildEvent`. Views point into the
+  // decoded bytes.
+  struct Event {
+    build_event_stream::BuildEvent::PayloadCase payload_case =
+      build_event_stream::BuildEvent::PAYLOAD_NOT_SET;
+    // Only for `kStarted`.
+    std::string_view workspace_directory;
+    google::protobuf::Timestamp start_time;
+    // Only for `kProgress`.
+    std::string_view stderr;
+  };
+
+  // Returns false if `bazel_event` is not a valid build event. Otherwise,
+  // `event` points into `bazel_event`, which must outlive it.
+  bool Decode(const google::protobuf::Any& bazel_event, Event& event) const;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_BUILD_EVENT_DECODER_H_
@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gimli/benchmark_testdata.h"
+#include "gimli/build_event_decoder.h"
+#include "google/protobuf/any.pb.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+namespace {
+
+// The events of the recorded build, as sent by Bazel.
+std::vector<google::protobuf::Any> RecordedEvents() {
+  std::vector<google::protobuf::Any> events;
+  for (const auto& request : BenchmarkTestdata::Recorded().requests()) {
+    events.push_back(request.ordered_build_event().event().bazel_event());
+  }
+  return events;
+}
+
+void BM_Decode(benchmark::State& state) {
+  const auto events = RecordedEvents();
+  BuildEventDecoder decoder;
+  for (auto _ : state) {
+    for (const auto& any : events) {
+      BuildEventDecoder::Event event;
+      benchmark::DoNotOptimize(decoder.Decode(any, event));
+      benchmark::DoNotOptimize(event);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+}
+BENCHMARK(BM_Decode);
+
+// How events were processed before the decoder, kept here as a baseline.
+void BM_UnpackTo(benchmark::State& state) {
+  const auto events = RecordedEvents();
+  for (auto _ : state) {
+    for (const auto& any : events) {
+      build_event_stream::BuildEvent build_event;
+      benchmark::DoNotOptimize(any.UnpackTo(&build_event));
+      benchmark::DoNotOptimize(build_event);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+}
+BENCHMARK(BM_UnpackTo);
+
+}  // namespace
+}  // namespace gimli
@@ -0,0 +1,110 @@
+#include "gimli/build_event_decoder.h"
+
+#include <string>
+
+#include "absl/status/status_matchers.h"
+#include "gimli/gtest_runfiles.h"
+#include "gimli/recording.pb.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/any.pb.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+namespace {
+using ::absl_testing::IsOk;
+using ::build_event_stream::BuildEvent;
+
+google::protobuf::Any Pack(const std::string& text) {
+  BuildEvent build_event;
+  EXPECT_TRUE(
+    google::protobuf::TextFormat::ParseFromString(text, &build_event));
+  google::protobuf::Any any;
+  any.PackFrom(build_event);
+  return any;
+}
+
+TEST(BuildEventDecoderTest, DecodesStarted) {
+  const auto any = Pack(R"pb(
+    id { started {} }
+    children { progress {} }
+    started {
+      uuid: "some-uuid"
+      workspace_directory: "/some/project"
+      start_time { seconds: 1764368148 nanos: 324000000 }
+    }
+  )pb");
+  BuildEventDecoder::Event event;
+  ASSERT_TRUE(BuildEventDecoder().Decode(any, event));
+  EXPECT_EQ(event.payload_case, BuildEvent::kStarted);
+  EXPECT_EQ(event.workspace_directory, "/some/project");
+  EXPECT_EQ(event.start_time.seconds(), 1764368148);
+  EXPECT_EQ(event.start_time.nanos(), 324000000);
+}
+
+TEST(BuildEventDecoderTest, DecodesProgress) {
+  const auto any = Pack(R"pb(
+    id { progress { opaque_count: 1 } }
+    progress { stdout: "out" stderr: "err" }
+  )pb");
+  BuildEventDecoder::Event event;
+  ASSERT_TRUE(BuildEventDecoder().Decode(any, event));
+  EXPECT_EQ(event.payload_case, BuildEvent::kProgress);
+  EXPECT_EQ(event.stderr, "err");
+}
+
+TEST(BuildEventDecoderTest, DecodesOnlyPayloadOfOtherEvents) {
+  const auto any = Pack(R"pb(
+    id { target_configured { label: "//some:target" } }
+    configured { target_kind: "cc_binary rule" }
+  )pb");
+  BuildEventDecoder::Event event;
+  ASSERT_TRUE(BuildEventDecoder().Decode(any, event));
+  EXPECT_EQ(event.payload_case, BuildEvent::kConfigured);
+  EXPECT_EQ(event.workspace_directory, "");
+  EXPECT_EQ(event.stderr, "");
+}
+
+TEST(BuildEventDecoderTest, RejectsInvalidEvents) {
+  BuildEventDecoder::Event event;
+  google::protobuf::Any any = Pack("progress { stderr: 'err' }");
+  any.set_type_url("type.googleapis.com/some.OtherMessage");
+  EXPECT_FALSE(BuildEventDecoder().Decode(any, event));
+
+  any = Pack("progress { stderr: 'err' }");
+  // Truncates the stderr.
+  any.mutable_value()->pop_back();
+  EXPECT_FALSE(BuildEventDecoder().Decode(any, event));
+}
+
+TEST(BuildEventDecoderTest, MatchesFullParsingOfRecording) {
+  auto data = Runfiles::ContentsOf("gimli/testdata/non_fatal_error.textproto");
+  ASSERT_THAT(data, IsOk());
+  gimli::Recording recording;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(*data, &recording));
+
+  for (const auto& request : recording.requests()) {
+    const auto& any = request.ordered_build_event().event().bazel_event();
+    BuildEvent build_event;
+    if (!any.UnpackTo(&build_event)) continue;
+
+    BuildEventDecoder::Event event;
+    ASSERT_TRUE(BuildEventDecoder().Decode(any, event));
+    EXPECT_EQ(event.payload_case, build_event.payload_case());
+    if (build_event.has_started()) {
+      EXPECT_EQ(event.workspace_directory,
+                build_event.started().workspace_directory());
+      EXPECT_EQ(event.start_time.seconds(),
+                build_event.started().start_time().seconds());
+      EXPECT_EQ(event.start_time.nanos(),
+                build_event.started().start_time().nanos());
+    }
+    if (build_event.has_progress()) {
+      EXPECT_EQ(event.stderr, build_event.progress().stderr());
+    }
+  }
+}
+
+}  // namespace
+}  // namespace gimli
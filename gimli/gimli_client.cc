@@ -12,6 +12,22 @@ ABSL_FLAG(
   std::optional<std::string>, path, std::nullopt,
   R"(If set, retrieves the report for the workspace containing this file.)"
   R"(If not set, retreives the report for the current working directory.)");
+ABSL_FLAG(std::optional<std::string>, invocation_id, std::nullopt,
+          "If set, retrieves the report of this Bazel invocation.");
+ABSL_FLAG(bool, watch, false,
+          "If true, prints the report every time it changes, until killed.");
+ABSL_FLAG(bool, stats, false,
+          "If true, prints the metrics of the server in the Prometheus text "
+          "format, instead of a report.");
+ABSL_FLAG(std::optional<std::string>, error_path, std::nullopt,
+          "If set, only retrieves the errors of this file.");
+ABSL_FLAG(int, max_errors, 0,
+          "If positive, retrieves at most this many errors, followed by the "
+          "token of the next page if there are more.");
+ABSL_FLAG(std::optional<std::string>, page_token, std::nullopt,
+          "If set, retrieves the page of errors of this token.");
+ABSL_FLAG(std::optional<uint64_t>, known_version, std::nullopt,
+          "If set, only retrieves what changed since this version.");
 
 int main(int argc, char** argv) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -25,11 +41,59 @@ int main(int argc, char** argv) {
   auto stub = gimli::proto::Gimli::NewStub(channel);
 
   grpc::ClientContext context;
+  if (absl::GetFlag(FLAGS_stats)) {
+    gimli::proto::GetStatsRequest request;
+    gimli::proto::GetStatsResponse response;
+    request.set_prometheus_text(true);
+    auto status = stub->GetStats(&context, request, &response);
+    if (!status.ok()) {
+      std::cerr << status.error_message();
+      return 1;
+    }
+    std::cout << response.prometheus_text();
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+  }
+
+  const std::string path =
+    absl::GetFlag(FLAGS_path).value_or(std::filesystem::current_path());
+
+  if (absl::GetFlag(FLAGS_watch)) {
+    gimli::proto::WatchReportRequest request;
+    gimli::proto::WatchReportResponse response;
+    request.set_path(path);
+
+    auto reader = stub->WatchReport(&context, request);
+    while (reader->Read(&response)) {
+      std::cout << response.DebugString() << std::flush;
+    }
+    auto status = reader->Finish();
+    if (!status.ok()) {
+      std::cerr << status.error_message();
+      return 1;
+    }
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+  }
+
   gimli::proto::GetReportRequest request;
   gimli::proto::GetReportResponse response;
-
-  request.set_path(
-    absl::GetFlag(FLAGS_path).value_or(std::filesystem::current_path()));
+  request.set_path(path);
+  if (const auto invocation_id = absl::GetFlag(FLAGS_invocation_id)) {
+    request.set_invocation_id(*invocation_id);
+  }
+  if (const auto error_path = absl::GetFlag(FLAGS_error_path)) {
+    request.mutable_filter()->set_path(*error_path);
+  }
+  if (const int max_errors = absl::GetFlag(FLAGS_max_errors); max_errors > 0) {
+    request.set_max_errors(max_errors);
+  }
+  if (const auto page_token = absl::GetFlag(FLAGS_page_token)) {
+    request.set_page_token(*page_token);
+  }
+  if (const auto known_version = absl::GetFlag(FLAGS_known_version)) {
+    request.set_known_version(*known_version);
+  }
 
   auto status = stub->GetReport(&context, request, &response);
   if (!status.ok()) {
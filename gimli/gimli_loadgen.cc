@@ -0,0 +1,267 @@
+// Replays recordings of Bazel builds against a running `gimli_server`, as
+// concurrent synthetic invocations, and reports its ingest rate and latencies.
+//
+// For example, with a server running on the default port:
+//
+//   bazel run //gimli:gimli_loadgen -- --invocations=100
+//     --recordings=$PWD/gimli/testdata/non_fatal_error.textproto
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/gimli.grpc.pb.h"
+#include "gimli/gimli.pb.h"
+#include "gimli/recording.pb.h"
+#include "gimli/recording_file.h"
+#include "google/devtools/build/v1/publish_build_event.grpc.pb.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/text_format.h"
+#include "grpcpp/grpcpp.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+ABSL_FLAG(uint16_t, port, 9090, "The port of the server.");
+ABSL_FLAG(std::vector<std::string>, recordings, {},
+          "Comma-separated paths of the recordings to replay, either "
+          "textprotos or .binpb files written by `gimli_server --record`.");
+ABSL_FLAG(int, invocations, 10,
+          "Number of concurrent synthetic Bazel invocations.");
+ABSL_FLAG(int, repetitions, 1,
+          "Number of times each invocation replays the recordings.");
+ABSL_FLAG(int, get_report_threads, 1,
+          "Number of threads calling GetReport while events are ingested.");
+ABSL_FLAG(std::string, workspace_root, "/tmp/gimli_loadgen",
+          "Directory under which each invocation has its own workspace.");
+
+namespace gimli {
+namespace {
+using ::build_event_stream::BuildEvent;
+using ::google::devtools::build::v1::PublishBuildEvent;
+using ::google::devtools::build::v1::PublishBuildToolEventStreamRequest;
+using ::google::devtools::build::v1::PublishBuildToolEventStreamResponse;
+using Clock = std::chrono::steady_clock;
+
+// Reads a recording in text format, or written by `gimli_server --record`.
+Recording ReadRecording(const std::filesystem::path& path) {
+  if (path.extension() == ".binpb") {
+    auto recording = RecordingFile::Read(path);
+    if (!recording.ok()) {
+      std::cerr << recording.status() << "\n";
+      std::exit(1);
+    }
+    return *std::move(recording);
+  }
+  std::ifstream stream(path);
+  if (!stream.is_open()) {
+    std::cerr << "Cannot open " << path << "\n";
+    std::exit(1);
+  }
+  const std::string data((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+  Recording recording;
+  if (!google::protobuf::TextFormat::ParseFromString(data, &recording)) {
+    std::cerr << "Cannot parse " << path << "\n";
+    std::exit(1);
+  }
+  return recording;
+}
+
+// Returns the requests of `recording`, rewritten to look like they come from
+// a distinct Bazel invocation, building in `workspace`.
+std::vector<PublishBuildToolEventStreamRequest> Rewrite(
+  const Recording& recording, std::string_view id,
+  const std::filesystem::path& workspace) {
+  std::vector<PublishBuildToolEventStreamRequest> requests;
+  for (auto request : recording.requests()) {
+    auto& ordered_build_event = *request.mutable_ordered_build_event();
+    auto& stream_id = *ordered_build_event.mutable_stream_id();
+    stream_id.set_build_id(absl::StrCat(id, "-", stream_id.build_id()));
+    stream_id.set_invocation_id(
+      absl::StrCat(id, "-", stream_id.invocation_id()));
+
+    auto& bazel_event = *ordered_build_event.mutable_event()
+                           ->mutable_bazel_event();
+    BuildEvent build_event;
+    if (bazel_event.UnpackTo(&build_event) && build_event.has_started()) {
+      build_event.mutable_started()->set_workspace_directory(workspace);
+      bazel_event.PackFrom(build_event);
+    }
+    requests.push_back(std::move(request));
+  }
+  return requests;
+}
+
+// Latencies in microseconds, collected concurrently.
+class Latencies {
+ public:
+  void Add(Clock::duration latency) {
+    std::scoped_lock lock(mutex_);
+    values_.push_back(
+      std::chrono::duration<double, std::micro>(latency).count());
+  }
+
+  // Prints the count and percentiles of the latencies.
+  void Print(std::string_view name) {
+    std::scoped_lock lock(mutex_);
+    std::sort(values_.begin(), values_.end());
+    const auto percentile = [&](int p) {
+      return values_.empty() ? 0.0 : values_[(values_.size() - 1) * p / 100];
+    };
+    std::cout << absl::StrFormat(
+      "%-16s count=%d p50=%.0fus p90=%.0fus p99=%.0fus max=%.0fus\n", name,
+      values_.size(), percentile(50), percentile(90), percentile(99),
+      percentile(100));
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<double> values_;
+};
+
+// Streams `requests` like Bazel does, and records the latency of each
+// acknowledgement. Returns the number of events acknowledged.
+size_t Replay(PublishBuildEvent::Stub& stub,
+              const std::vector<PublishBuildToolEventStreamRequest>& requests,
+              Latencies& ack_latencies) {
+  grpc::ClientContext context;
+  auto stream = stub.PublishBuildToolEventStream(&context);
+  // Acknowledgements come in order, so the i-th response is for the i-th
+  // request: the sending times are shared with the reading thread.
+  std::vector<std::atomic<Clock::rep>> sent(requests.size());
+  size_t acknowledged = 0;
+  std::thread reader([&]() {
+    PublishBuildToolEventStreamResponse response;
+    while (acknowledged < requests.size() && stream->Read(&response)) {
+      const auto sent_time = Clock::time_point(
+        Clock::duration(sent[acknowledged].load(std::memory_order_acquire)));
+      ack_latencies.Add(Clock::now() - sent_time);
+      ++acknowledged;
+    }
+  });
+  for (size_t i = 0; i < requests.size(); ++i) {
+    sent[i].store(Clock::now().time_since_epoch().count(),
+                  std::memory_order_release);
+    if (!stream->Write(requests[i])) break;
+  }
+  stream->WritesDone();
+  reader.join();
+  if (auto status = stream->Finish(); !status.ok()) {
+    std::cerr << "Stream failed: " << status.error_message() << "\n";
+  }
+  return acknowledged;
+}
+
+int Main() {
+  const std::string address =
+    absl::StrCat("127.0.0.1:", absl::GetFlag(FLAGS_port));
+  const int invocations = absl::GetFlag(FLAGS_invocations);
+  const std::filesystem::path workspace_root =
+    absl::GetFlag(FLAGS_workspace_root);
+  if (invocations < 1 || absl::GetFlag(FLAGS_repetitions) < 1) {
+    std::cerr << "--invocations and --repetitions must be at least 1\n";
+    return 1;
+  }
+
+  std::vector<Recording> recordings;
+  for (const auto& path : absl::GetFlag(FLAGS_recordings)) {
+    recordings.push_back(ReadRecording(path));
+  }
+  if (recordings.empty()) {
+    std::cerr << "--recordings is required\n";
+    return 1;
+  }
+
+  // Rewriting is done upfront, so it doesn't slow down the replay.
+  std::vector<std::vector<std::vector<PublishBuildToolEventStreamRequest>>>
+    requests(invocations);
+  for (int i = 0; i < invocations; ++i) {
+    for (int repetition = 0; repetition < absl::GetFlag(FLAGS_repetitions);
+         ++repetition) {
+      for (size_t r = 0; r < recordings.size(); ++r) {
+        requests[i].push_back(
+          Rewrite(recordings[r], absl::StrCat("loadgen-", i, "-", repetition),
+                  workspace_root / absl::StrCat("workspace", i)));
+      }
+    }
+  }
+
+  auto channel =
+    grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
+  auto pbe_stub = PublishBuildEvent::NewStub(channel);
+  auto gimli_stub = proto::Gimli::NewStub(channel);
+
+  Latencies ack_latencies;
+  Latencies get_report_latencies;
+  std::atomic<size_t> events = 0;
+  std::atomic<bool> ingesting = true;
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < absl::GetFlag(FLAGS_get_report_threads); ++t) {
+    readers.emplace_back([&, t]() {
+      for (int i = t; ingesting.load(); ++i) {
+        grpc::ClientContext context;
+        proto::GetReportRequest request;
+        proto::GetReportResponse response;
+        request.set_path(workspace_root /
+                         absl::StrCat("workspace", i % invocations));
+        const auto start = Clock::now();
+        const auto status = gimli_stub->GetReport(&context, request, &response);
+        // Not found is expected until the invocation's build started.
+        if (status.ok() || status.error_code() == grpc::StatusCode::NOT_FOUND) {
+          get_report_latencies.Add(Clock::now() - start);
+        }
+      }
+    });
+  }
+
+  const auto start = absl::Now();
+  std::vector<std::thread> writers;
+  for (int i = 0; i < invocations; ++i) {
+    writers.emplace_back([&, i]() {
+      for (const auto& stream_requests : requests[i]) {
+        events += Replay(*pbe_stub, stream_requests, ack_latencies);
+      }
+    });
+  }
+  for (auto& writer : writers) writer.join();
+  const auto elapsed = absl::Now() - start;
+  ingesting = false;
+  for (auto& reader : readers) reader.join();
+
+  std::cout << absl::StrFormat(
+    "%d events in %s: %.0f events/s\n", events.load(),
+    absl::FormatDuration(elapsed), events / absl::ToDoubleSeconds(elapsed));
+  ack_latencies.Print("Ack");
+  get_report_latencies.Print("GetReport");
+  return 0;
+}
+
+}  // namespace
+}  // namespace gimli
+
+int main(int argc, char** argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  absl::ParseCommandLine(argc, argv);
+  const int result = gimli::Main();
+  google::protobuf::ShutdownProtobufLibrary();
+  return result;
+}
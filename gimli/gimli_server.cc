@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
@@ -14,9 +15,13 @@
 #include "absl/log/initialize.h"
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
 #include "gimli/gimli_service_impl.h"
+#include "gimli/metrics.h"
 #include "gimli/publish_build_event_callback_service_impl.h"
+#include "gimli/report_store.h"
 #include "gimli/reporter.h"
+#include "gimli/tracer.h"
 #include "google/protobuf/stubs/common.h"
 #include "grpcpp/ext/proto_server_reflection_plugin.h"
 #include "grpcpp/grpcpp.h"
@@ -24,11 +29,45 @@
 
 ABSL_FLAG(uint16_t, port, 9090, "The port where to listen");
 ABSL_FLAG(bool, record, false,
-          "If true, even stream are recorded in testdata.");
+          "If true, event streams are recorded in gimli/testdata.");
+ABSL_FLAG(int, workers,
+          static_cast<int>(std::max(1u, std::thread::hardware_concurrency())),
+          "Number of threads processing the build events.");
+ABSL_FLAG(uint64_t, max_report_bytes, 0,
+          "Memory budget of the reports, beyond which the least recently "
+          "used are evicted. Zero means unlimited.");
+ABSL_FLAG(absl::Duration, report_ttl, absl::InfiniteDuration(),
+          "Reports neither updated nor read for this long are evicted.");
+ABSL_FLAG(std::string, store_path, "",
+          "If set, the file where finished reports are stored, so they are "
+          "restored when the server restarts.");
+ABSL_FLAG(std::string, trace_file, "",
+          "If set, the file where the processing of the build event streams "
+          "is traced, as Chrome trace events loadable in Perfetto. Written "
+          "when the server stops.");
+ABSL_FLAG(int, max_streams, 0,
+          "Build event streams processed at once, beyond which new ones are "
+          "rejected. Zero means unlimited.");
+ABSL_FLAG(uint64_t, max_stream_bytes, 0,
+          "Bytes of build events of a stream waiting to be processed, beyond "
+          "which it is no longer read until they are. Zero means unlimited.");
+ABSL_FLAG(uint64_t, max_errors_per_report, 0,
+          "Errors kept in the report of a build, beyond which they are "
+          "dropped. Zero means unlimited.");
+ABSL_FLAG(uint64_t, max_inflight_bytes, 0,
+          "Bytes of build events of all streams waiting to be processed, "
+          "beyond which new streams are rejected. Zero means unlimited.");
+ABSL_FLAG(uint64_t, grpc_memory_quota, 0,
+          "Memory that gRPC may use for the calls, beyond which it rejects "
+          "new ones. Zero means unlimited.");
 
 using gimli::GimliServiceImpl;
+using gimli::Metrics;
 using gimli::PublishBuildEventCallbackServiceImpl;
+using gimli::ReportStore;
 using gimli::Reporter;
+using gimli::StreamLimits;
+using gimli::Tracer;
 
 namespace {
 volatile std::sig_atomic_t interrupted = 0;
@@ -45,6 +84,11 @@ int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
   absl::InitializeLog();
 
+  if (absl::GetFlag(FLAGS_workers) < 1) {
+    std::cerr << "--workers must be at least 1\n";
+    return 1;
+  }
+
   std::optional<std::filesystem::path> testdata;
   if (absl::GetFlag(FLAGS_record)) {
     const char* workspace = std::getenv("BUILD_WORKSPACE_DIRECTORY");
@@ -62,23 +106,83 @@ int main(int argc, char** argv) {
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
 
   std::signal(SIGINT, sigint_handler);
-  Reporter reporter;
-  GimliServiceImpl gimli_service(&reporter);
-  PublishBuildEventCallbackServiceImpl pbes_callback_service(reporter,
-                                                             testdata);
+  Metrics metrics;
+  Reporter reporter({
+    .max_bytes = absl::GetFlag(FLAGS_max_report_bytes),
+    .ttl = absl::GetFlag(FLAGS_report_ttl),
+    .lock_hold = &metrics.AddHistogram(
+      "gimli_reporter_lock_hold_seconds",
+      "Time a report addition holds the reporter lock.", 1e-9),
+  });
+  metrics.AddComputedGauge("gimli_reports", "Reports stored.", [&reporter]() {
+    return static_cast<int64_t>(reporter.GetStats().reports);
+  });
+  metrics.AddComputedGauge(
+    "gimli_report_bytes", "Memory used by the reports.", [&reporter]() {
+      return static_cast<int64_t>(reporter.GetStats().bytes);
+    });
+  // The store, the tracer, the services and the server are destroyed before
+  // protobuf is shut down: after the server shuts down, the workers still
+  // process the last requests, and the store appends the last reports.
+  {
+    std::unique_ptr<ReportStore> store;
+    if (const std::string store_path = absl::GetFlag(FLAGS_store_path);
+        !store_path.empty()) {
+      auto opened = ReportStore::Open(store_path, reporter);
+      if (!opened.ok()) {
+        LOG(ERROR) << "Cannot open the report store: " << opened.status();
+        return 1;
+      }
+      store = *std::move(opened);
+    }
+    // Declared before the services, so the trace is written after they are
+    // destroyed, once nothing traces anymore.
+    std::unique_ptr<Tracer> tracer;
+    if (const std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+        !trace_file.empty()) {
+      auto created = Tracer::Create(trace_file);
+      if (!created.ok()) {
+        LOG(ERROR) << "Cannot trace: " << created.status();
+        return 1;
+      }
+      tracer = *std::move(created);
+    }
+    GimliServiceImpl gimli_service(&reporter, &metrics);
+    PublishBuildEventCallbackServiceImpl pbes_callback_service(
+      reporter, metrics, tracer.get(), testdata, absl::GetFlag(FLAGS_workers),
+      StreamLimits{
+        .max_streams = absl::GetFlag(FLAGS_max_streams),
+        .max_stream_bytes = absl::GetFlag(FLAGS_max_stream_bytes),
+        .max_errors_per_report = absl::GetFlag(FLAGS_max_errors_per_report),
+        .max_inflight_bytes = absl::GetFlag(FLAGS_max_inflight_bytes),
+      });
 
-  grpc::ServerBuilder builder;
-  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
-  builder.RegisterService(&gimli_service);
-  builder.RegisterService(&pbes_callback_service);
-  LOG(INFO) << "Server started on " << address;
-  auto server = builder.BuildAndStart();
-  while (!interrupted) {
-    static constexpr auto kDuration = std::chrono::milliseconds(100);
-    std::this_thread::sleep_for(kDuration);
+    grpc::ServerBuilder builder;
+    if (const uint64_t quota = absl::GetFlag(FLAGS_grpc_memory_quota);
+        quota > 0) {
+      grpc::ResourceQuota resource_quota("gimli");
+      resource_quota.Resize(quota);
+      builder.SetResourceQuota(resource_quota);
+    }
+    builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&gimli_service);
+    builder.RegisterService(&pbes_callback_service);
+    LOG(INFO) << "Server started on " << address;
+    auto server = builder.BuildAndStart();
+    for (int i = 1; !interrupted; ++i) {
+      static constexpr auto kDuration = std::chrono::milliseconds(100);
+      std::this_thread::sleep_for(kDuration);
+      // Expired reports are evicted every second.
+      if (i % 10 == 0) reporter.Evict();
+    }
+    server->Shutdown();
   }
-  server->Shutdown();
-  LOG(INFO) << "Server down on " << address;
+  const auto stats = reporter.GetStats();
+  LOG(INFO) << "Server down on " << address << " with " << stats.reports
+            << " reports of " << stats.bytes << " bytes, after " << stats.hits
+            << " hits, " << stats.misses << " misses and " << stats.evictions
+            << " evictions";
+  VLOG(1) << "Metrics:\n" << Metrics::ToPrometheusText(metrics.Collect());
 
   google::protobuf::ShutdownProtobufLibrary();
   return 0;
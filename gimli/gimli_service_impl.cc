@@ -1,54 +1,347 @@
 #include "gimli/gimli_service_impl.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include "absl/base/nullability.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/substitute.h"
+#include "absl/time/time.h"
 #include "gimli/gimli.pb.h"
-#include "google/protobuf/util/time_util.h"
+#include "gimli/metrics.h"
+#include "gimli/report.h"
+#include "gimli/report_converter.h"
 #include "grpcpp/grpcpp.h"
+#include "grpcpp/support/server_callback.h"
 
 namespace gimli {
-using ::google::protobuf::util::TimeUtil;
+namespace {
 
-GimliServiceImpl::GimliServiceImpl(const Reporter* absl_nonnull reporter)
-  : reporter_(reporter) {}
-
-grpc::Status GimliServiceImpl::GetReport(
-  grpc::ServerContext* absl_nonnull context,
-  const proto::GetReportRequest* absl_nonnull request,
-  proto::GetReportResponse* absl_nonnull response) {
-  if (!request->has_path()) {
+// Checks the `path` of a request, which must be set and absolute.
+template <typename Request>
+grpc::Status CheckPath(const Request& request) {
+  if (!request.has_path()) {
     return {grpc::StatusCode::INVALID_ARGUMENT, "missing `path` in request"};
   }
-  const std::filesystem::path path(request->path());
-  if (!path.is_absolute()) {
+  if (!std::filesystem::path(request.path()).is_absolute()) {
     return {grpc::StatusCode::INVALID_ARGUMENT, "`path` must be absolute"};
   }
+  return grpc::Status::OK;
+}
 
-  const auto report = reporter_->GetReportFor(path);
-  if (!report.has_value()) {
-    return {grpc::StatusCode::NOT_FOUND,
-            absl::Substitute("No report for workspace `$0`", request->path())};
+// Returns the token of the page of `report` starting at error `index`. As
+// errors are only appended to a report, the token stays valid as long as the
+// report is for the same build, which its time identifies.
+std::string PageToken(const Report& report, size_t index) {
+  return absl::StrCat(absl::ToUnixNanos(report.time), "/", index);
+}
+
+// Sets `first_error` to the index of the error of `report` where the page of
+// `token` starts.
+grpc::Status ParsePageToken(const Report& report, std::string_view token,
+                            size_t& first_error) {
+  const size_t separator = token.find('/');
+  int64_t time_nanos = 0;
+  if (separator == std::string_view::npos ||
+      !absl::SimpleAtoi(token.substr(0, separator), &time_nanos) ||
+      !absl::SimpleAtoi(token.substr(separator + 1), &first_error)) {
+    return {grpc::StatusCode::INVALID_ARGUMENT, "invalid `page_token`"};
   }
+  if (time_nanos != absl::ToUnixNanos(report.time) ||
+      first_error > report.errors.size()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "`page_token` is for another build"};
+  }
+  return grpc::Status::OK;
+}
 
-  auto& report_proto = *response->mutable_report();
-  report_proto.set_workspace_path(report->workspace_path);
-  *report_proto.mutable_time() =
-    TimeUtil::NanosecondsToTimestamp(absl::ToUnixNanos(report->time));
+// Fills `response` with the errors of `report` which `request` selects, and
+// the token of the next page if some are left. Only the errors added since
+// the version known by the client are returned, if any.
+grpc::Status FillErrors(const Report& report,
+                        const proto::GetReportRequest& request,
+                        proto::GetReportResponse& response) {
+  if (request.max_errors() < 0) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "`max_errors` must not be negative"};
+  }
+  size_t first_error = 0;
+  if (request.has_page_token()) {
+    auto status = ParsePageToken(report, request.page_token(), first_error);
+    if (!status.ok()) return status;
+  }
 
-  for (const auto& error : report->errors) {
-    auto& error_proto = *report_proto.add_errors();
-    error_proto.set_path_in_workspace(error.path_in_workspace);
-    error_proto.set_line(error.line);
-    if (error.column != -1) error_proto.set_column(error.column);
-    error_proto.set_message(error.message);
-    for (const auto& context : error.context) {
-      error_proto.add_context(context);
+  response.set_version(report.version);
+  size_t first_new_error = 0;
+  if (request.has_known_version()) {
+    if (request.known_version() == report.version) {
+      response.set_not_modified(true);
+      return grpc::Status::OK;
+    }
+    for (const auto& past : report.past_versions) {
+      if (past.version == request.known_version()) {
+        first_new_error = past.errors;
+        response.set_only_new_errors(true);
+        break;
+      }
     }
   }
 
+  // A file is looked up in the index of the errors by path, so only its
+  // errors are visited, rather than all of them.
+  const auto& filter = request.filter();
+  std::optional<std::vector<size_t>> indices;
+  switch (filter.file_case()) {
+    case proto::ErrorFilter::kPath: {
+      std::filesystem::path path(filter.path());
+      if (path.is_absolute()) {
+        path = path.lexically_relative(report.workspace_path);
+      }
+      indices = report.errors.IndicesInPath(path.native());
+      break;
+    }
+    case proto::ErrorFilter::kPathPrefix:
+      indices = report.errors.IndicesUnderPrefix(filter.path_prefix());
+      break;
+    case proto::ErrorFilter::FILE_NOT_SET:
+      break;
+  }
+
+  // The report without errors, which are then added one by one.
+  ToProto(report, *response.mutable_report(), report.errors.size());
+  auto& errors = *response.mutable_report()->mutable_errors();
+  const size_t max_errors = request.max_errors() > 0
+                              ? static_cast<size_t>(request.max_errors())
+                              : std::numeric_limits<size_t>::max();
+  const size_t candidates =
+    indices.has_value() ? indices->size() : report.errors.size();
+  int32_t total_errors = 0;
+  for (size_t i = 0; i < candidates; ++i) {
+    const size_t index = indices.has_value() ? (*indices)[i] : i;
+    if (index < first_new_error) continue;
+    const auto error = report.errors[index];
+    if (filter.has_first_line() && error.line < filter.first_line()) continue;
+    if (filter.has_last_line() && error.line > filter.last_line()) continue;
+    ++total_errors;
+    if (index < first_error) continue;
+    if (static_cast<size_t>(errors.size()) < max_errors) {
+      ToProto(error, *errors.Add());
+    } else if (!response.has_next_page_token()) {
+      response.set_next_page_token(PageToken(report, index));
+    }
+  }
+  response.set_total_errors(total_errors);
   return grpc::Status::OK;
 }
 
+// Fills `response` with the report of the workspace containing the path.
+grpc::Status FillReport(const Reporter& reporter,
+                        const proto::GetReportRequest& request,
+                        proto::GetReportResponse& response) {
+  if (auto status = CheckPath(request); !status.ok()) return status;
+
+  if (request.has_invocation_id()) {
+    const auto report =
+      reporter.GetReportFor(request.path(), request.invocation_id());
+    if (report == nullptr) {
+      return {grpc::StatusCode::NOT_FOUND,
+              absl::Substitute("No report for invocation `$0` in `$1`",
+                               request.invocation_id(), request.path())};
+    }
+    return FillErrors(*report, request, response);
+  }
+
+  const auto report = reporter.GetReportFor(request.path());
+  if (report == nullptr) {
+    return {grpc::StatusCode::NOT_FOUND,
+            absl::Substitute("No report for workspace `$0`", request.path())};
+  }
+
+  return FillErrors(*report, request, response);
+}
+
+void ToProto(const Metrics::Sample& sample, proto::Metric& metric) {
+  metric.set_name(sample.name);
+  metric.set_help(sample.help);
+  for (const auto& [key, value] : sample.labels) {
+    (*metric.mutable_labels())[key] = value;
+  }
+  switch (sample.type) {
+    case Metrics::Type::kCounter:
+      metric.set_counter(static_cast<uint64_t>(sample.value));
+      break;
+    case Metrics::Type::kGauge:
+      metric.set_gauge(static_cast<int64_t>(sample.value));
+      break;
+    case Metrics::Type::kHistogram: {
+      const auto& snapshot = sample.histogram;
+      const auto scaled = [&sample](uint64_t value) {
+        return static_cast<double>(value) * sample.scale;
+      };
+      auto& histogram = *metric.mutable_histogram();
+      histogram.set_count(snapshot.count);
+      histogram.set_sum(scaled(snapshot.sum));
+      histogram.set_max(scaled(snapshot.max));
+      histogram.set_p50(scaled(snapshot.ValueAt(0.5)));
+      histogram.set_p90(scaled(snapshot.ValueAt(0.9)));
+      histogram.set_p99(scaled(snapshot.ValueAt(0.99)));
+      for (const auto& [max_value, count] : snapshot.buckets) {
+        auto& bucket = *histogram.add_buckets();
+        bucket.set_max_value(scaled(max_value));
+        bucket.set_count(count);
+      }
+      break;
+    }
+  }
+}
+
+// Returns whether `path` is `base` or inside it.
+bool IsSubpath(const std::filesystem::path& path,
+               const std::filesystem::path& base) {
+  const auto normal_path = path.lexically_normal();
+  const auto normal_base = base.lexically_normal();
+  const auto pair = std::mismatch(normal_path.begin(), normal_path.end(),
+                                  normal_base.begin(), normal_base.end());
+  return pair.second == normal_base.end() ||
+         (std::next(pair.second) == normal_base.end() && pair.second->empty());
+}
+
+}  // namespace
+
+GimliServiceImpl::GimliServiceImpl(const Reporter* absl_nonnull reporter,
+                                   const Metrics* absl_nonnull metrics)
+  : reporter_(reporter), metrics_(metrics) {}
+
+grpc::ServerUnaryReactor* GimliServiceImpl::GetReport(
+  grpc::CallbackServerContext* absl_nonnull context,
+  const proto::GetReportRequest* absl_nonnull request,
+  proto::GetReportResponse* absl_nonnull response) {
+  // Getting the report neither blocks nor waits, so the reactor is finished
+  // right away, in the gRPC thread which received the request.
+  auto* reactor = context->DefaultReactor();
+  reactor->Finish(FillReport(*reporter_, *request, *response));
+  return reactor;
+}
+
+grpc::ServerWriteReactor<proto::WatchReportResponse>*
+GimliServiceImpl::WatchReport(grpc::CallbackServerContext* context,
+                              const proto::WatchReportRequest* request) {
+  // Watchers are idle most of the time, so they don't hold a thread: they
+  // are woken up by the reporter, and only write the latest report once the
+  // previous write is done.
+  class Reactor final
+    : public grpc::ServerWriteReactor<proto::WatchReportResponse> {
+   public:
+    Reactor(const Reporter* absl_nonnull reporter,
+            const proto::WatchReportRequest& request)
+      : reporter_(reporter), path_(request.path()) {
+      if (auto status = CheckPath(request); !status.ok()) {
+        finished_ = true;
+        Finish(status);
+        return;
+      }
+      // Subscribe before the first write, so that no change can be missed.
+      subscription_ = reporter_->Subscribe([this](const Report& report) {
+        if (!IsSubpath(path_, report.workspace_path)) return;
+        std::scoped_lock lock(mutex_);
+        MaybeWrite();
+      });
+      std::scoped_lock lock(mutex_);
+      MaybeWrite();
+    }
+
+    void OnWriteDone(bool ok) final {
+      std::scoped_lock lock(mutex_);
+      writing_ = false;
+      if (!ok) {
+        FinishOnce(grpc::Status::CANCELLED);
+        return;
+      }
+      MaybeWrite();
+    }
+
+    void OnCancel() final {
+      std::scoped_lock lock(mutex_);
+      FinishOnce(grpc::Status::CANCELLED);
+    }
+
+    void OnDone() final { delete this; }
+
+   private:
+    // Writes the report for the path if it changed since the last write and
+    // no write is ongoing. Must be called with `mutex_` held.
+    void MaybeWrite() {
+      if (writing_ || finished_) return;
+      auto report = reporter_->GetReportFor(path_);
+      if (report == nullptr || report == sent_) return;
+
+      // A running build's report only gets new errors appended.
+      const bool only_new_errors =
+        sent_ != nullptr && report->workspace_path == sent_->workspace_path &&
+        report->invocation_id == sent_->invocation_id &&
+        report->time == sent_->time &&
+        report->errors.size() >= sent_->errors.size();
+      response_.Clear();
+      ToProto(*report, *response_.mutable_report(),
+              only_new_errors ? sent_->errors.size() : 0);
+      if (only_new_errors) response_.set_only_new_errors(true);
+      sent_ = std::move(report);
+      writing_ = true;
+      StartWrite(&response_);
+    }
+
+    // Must be called with `mutex_` held.
+    void FinishOnce(grpc::Status status) {
+      if (finished_) return;
+      finished_ = true;
+      Finish(std::move(status));
+    }
+
+    const Reporter* absl_nonnull reporter_;
+    const std::filesystem::path path_;
+
+    std::mutex mutex_;
+    bool writing_ = false;
+    bool finished_ = false;
+    std::shared_ptr<const Report> sent_;
+    proto::WatchReportResponse response_;
+
+    // Last member, so it's destroyed first and the listener is never called
+    // on a partially destroyed reactor.
+    Reporter::Subscription subscription_;
+  };
+
+  return new Reactor(reporter_, *request);
+}
+
+grpc::ServerUnaryReactor* GimliServiceImpl::GetStats(
+  grpc::CallbackServerContext* absl_nonnull context,
+  const proto::GetStatsRequest* absl_nonnull request,
+  proto::GetStatsResponse* absl_nonnull response) {
+  // Collecting the metrics is quick, so like `GetReport` it's done right away.
+  const auto samples = metrics_->Collect();
+  if (request->prometheus_text()) {
+    response->set_prometheus_text(Metrics::ToPrometheusText(samples));
+  } else {
+    for (const auto& sample : samples) {
+      ToProto(sample, *response->add_metrics());
+    }
+  }
+  auto* reactor = context->DefaultReactor();
+  reactor->Finish(grpc::Status::OK);
+  return reactor;
+}
+
 }  // namespace gimli
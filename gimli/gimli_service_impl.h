@@ -4,20 +4,33 @@
 #include "absl/base/nullability.h"
 #include "gimli/gimli.grpc.pb.h"
 #include "gimli/gimli.pb.h"
+#include "gimli/metrics.h"
 #include "gimli/reporter.h"
 
 namespace gimli {
 
-class GimliServiceImpl final : public proto::Gimli::Service {
+class GimliServiceImpl final : public proto::Gimli::CallbackService {
  public:
-  GimliServiceImpl(const Reporter* absl_nonnull reporter);
+  GimliServiceImpl(const Reporter* absl_nonnull reporter,
+                   const Metrics* absl_nonnull metrics);
 
-  grpc::Status GetReport(grpc::ServerContext* absl_nonnull context,
-                         const proto::GetReportRequest* absl_nonnull request,
-                         proto::GetReportResponse* absl_nonnull response) final;
+  grpc::ServerUnaryReactor* absl_nonnull GetReport(
+    grpc::CallbackServerContext* absl_nonnull context,
+    const proto::GetReportRequest* absl_nonnull request,
+    proto::GetReportResponse* absl_nonnull response) final;
+
+  grpc::ServerWriteReactor<proto::WatchReportResponse>* absl_nonnull
+  WatchReport(grpc::CallbackServerContext* absl_nonnull context,
+              const proto::WatchReportRequest* absl_nonnull request) final;
+
+  grpc::ServerUnaryReactor* absl_nonnull GetStats(
+    grpc::CallbackServerContext* absl_nonnull context,
+    const proto::GetStatsRequest* absl_nonnull request,
+    proto::GetStatsResponse* absl_nonnull response) final;
 
  private:
   const Reporter* absl_nonnull reporter_;
+  const Metrics* absl_nonnull metrics_;
 };
 
 }  // namespace gimli
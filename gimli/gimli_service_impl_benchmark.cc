@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gimli/benchmark_testdata.h"
+#include "gimli/gimli.grpc.pb.h"
+#include "gimli/gimli.pb.h"
+#include "gimli/gimli_service_impl.h"
+#include "gimli/grpc_test_server.h"
+#include "gimli/metrics.h"
+#include "gimli/report.h"
+#include "gimli/report.pb.h"
+#include "gimli/report_converter.h"
+#include "gimli/reporter.h"
+#include "grpcpp/grpcpp.h"
+
+namespace gimli {
+namespace {
+
+// The synchronous implementation of `GetReport`, from before the service was
+// moved to the callback API, kept here as a baseline.
+class SyncGimliServiceImpl final : public proto::Gimli::Service {
+ public:
+  // Takes the same arguments as `GimliServiceImpl`, but has no metrics.
+  SyncGimliServiceImpl(const Reporter* reporter, const Metrics* metrics)
+    : reporter_(reporter) {}
+
+  grpc::Status GetReport(grpc::ServerContext* context,
+                         const proto::GetReportRequest* request,
+                         proto::GetReportResponse* response) final {
+    const auto report = reporter_->GetReportFor(request->path());
+    if (report == nullptr) return {grpc::StatusCode::NOT_FOUND, ""};
+    ToProto(*report, *response->mutable_report());
+    return grpc::Status::OK;
+  }
+
+ private:
+  const Reporter* reporter_;
+};
+
+// Benchmarks take the number of errors in the report as argument.
+void BM_ToProto(benchmark::State& state) {
+  const Report report =
+    BenchmarkTestdata::MakeReport("/some/project", state.range(0));
+  for (auto _ : state) {
+    proto::Report report_proto;
+    ToProto(report, report_proto);
+    benchmark::DoNotOptimize(report_proto);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToProto)->Range(1, 10000);
+
+template <typename Service>
+struct Server {
+  Server() {
+    reporter.AddReport(BenchmarkTestdata::MakeReport("/some/project", 10));
+  }
+
+  Reporter reporter;
+  Metrics metrics;
+  Service service{&reporter, &metrics};
+  TestServer test_server =
+    TestServer::Builder().RegisterService(&service).BuildAndStart();
+};
+
+// The server is shared by all the threads of a benchmark, which are its
+// clients, and by all its runs. It is never destroyed.
+template <typename Service>
+Server<Service>& GetServer() {
+  static auto* const server = new Server<Service>();
+  return *server;
+}
+
+// Measures the throughput of concurrent `GetReport` calls, and their tail
+// latency, reported as the 99th percentile averaged over threads.
+template <typename Service>
+void BM_GetReport(benchmark::State& state) {
+  auto stub = GetServer<Service>().test_server.template NewStub<proto::Gimli>();
+  std::vector<double> latencies;
+
+  for (auto _ : state) {
+    grpc::ClientContext context;
+    proto::GetReportRequest request;
+    proto::GetReportResponse response;
+    request.set_path("/some/project/file.cc");
+    const auto start = std::chrono::steady_clock::now();
+    const auto status = stub->GetReport(&context, request, &response);
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+    if (!status.ok()) state.SkipWithError(status.error_message().c_str());
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  if (!latencies.empty()) {
+    state.counters["p99_us"] = benchmark::Counter(
+      latencies[latencies.size() * 99 / 100], benchmark::Counter::kAvgThreads);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetReport<GimliServiceImpl>)
+  ->ThreadRange(1, 64)
+  ->UseRealTime();
+BENCHMARK(BM_GetReport<SyncGimliServiceImpl>)
+  ->ThreadRange(1, 64)
+  ->UseRealTime();
+
+}  // namespace
+}  // namespace gimli
@@ -1,23 +1,37 @@
 #include "gimli/gimli_service_impl.h"
 
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
 #include "gimli/gimli.grpc.pb.h"
 #include "gimli/gimli.pb.h"
 #include "gimli/grpc_test_server.h"
+#include "gimli/metrics.h"
 #include "gimli/reporter.h"
 #include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 #include "protobuf-matchers/protocol-buffer-matchers.h"
 
 namespace gimli {
 namespace {
 using ::protobuf_matchers::EqualsProto;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
 
 class GimliServiceImplTest : public testing::Test {
  protected:
   ~GimliServiceImplTest() { std::move(test_server_).Shutdown(); }
 
   Reporter reporter_;
-  GimliServiceImpl under_test_{&reporter_};
+  Metrics metrics_;
+  GimliServiceImpl under_test_{&reporter_, &metrics_};
 
   TestServer test_server_ =
     TestServer::Builder().RegisterService(&under_test_).BuildAndStart();
@@ -83,6 +97,10 @@ TEST_F(GimliServiceImplTest, ReturnsReportWhenExisting) {
   request.set_path("/some/project/file.cc");
   const auto status = stub_->GetReport(&context, request, &response);
   ASSERT_TRUE(status.ok()) << status.error_message();
+  // The version is set by the reporter.
+  EXPECT_EQ(response.version(),
+            reporter_.GetReportFor("/some/project")->version);
+  response.clear_version();
   EXPECT_THAT(response,
               EqualsProto(R"pb(report {
                                  workspace_path: "/some/project"
@@ -94,7 +112,276 @@ TEST_F(GimliServiceImplTest, ReturnsReportWhenExisting) {
                                    context: "Here..."
                                    context: "...or there"
                                  }
+                                 status: STATUS_FINISHED
+                               }
+                               total_errors: 1)pb"));
+}
+
+TEST_F(GimliServiceImplTest, ReturnsReportOfInvocation) {
+  reporter_.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "sync",
+    .status = Report::Status::kRunning,
+  });
+  reporter_.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "build",
+    .errors = {{.path_in_workspace = "main.cc", .line = 5}},
+  });
+
+  grpc::ClientContext context;
+  proto::GetReportRequest request;
+  proto::GetReportResponse response;
+
+  request.set_path("/some/project/file.cc");
+  request.set_invocation_id("sync");
+  const auto status = stub_->GetReport(&context, request, &response);
+  ASSERT_TRUE(status.ok()) << status.error_message();
+  response.clear_version();
+  EXPECT_THAT(response,
+              EqualsProto(R"pb(report {
+                                 workspace_path: "/some/project"
+                                 invocation_id: "sync"
+                                 time {}
+                                 status: STATUS_RUNNING
+                               }
+                               total_errors: 0)pb"));
+
+  grpc::ClientContext other_context;
+  request.set_invocation_id("unknown");
+  EXPECT_EQ(stub_->GetReport(&other_context, request, &response).error_code(),
+            grpc::StatusCode::NOT_FOUND);
+}
+
+TEST_F(GimliServiceImplTest, FiltersErrors) {
+  reporter_.AddReport({
+    .workspace_path = "/some/project",
+    .errors =
+      {
+        {.path_in_workspace = "lib/a.cc", .line = 1},
+        {.path_in_workspace = "main.cc", .line = 2},
+        {.path_in_workspace = "lib/a.cc", .line = 30},
+        {.path_in_workspace = "lib/b.cc", .line = 4},
+      },
+  });
+  const auto get_errors = [this](const std::string& filter) {
+    grpc::ClientContext context;
+    proto::GetReportRequest request;
+    proto::GetReportResponse response;
+    EXPECT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(filter, &request));
+    request.set_path("/some/project");
+    EXPECT_TRUE(stub_->GetReport(&context, request, &response).ok());
+    std::vector<std::string> errors;
+    for (const auto& error : response.report().errors()) {
+      errors.push_back(absl::StrCat(error.path_in_workspace(), ":",
+                                    error.line()));
+    }
+    EXPECT_EQ(response.total_errors(), static_cast<int>(errors.size()));
+    return errors;
+  };
+
+  EXPECT_THAT(get_errors(R"pb(filter { path: "lib/a.cc" })pb"),
+              ElementsAre("lib/a.cc:1", "lib/a.cc:30"));
+  EXPECT_THAT(get_errors(R"pb(filter { path: "/some/project/main.cc" })pb"),
+              ElementsAre("main.cc:2"));
+  EXPECT_THAT(get_errors(R"pb(filter { path_prefix: "lib/" })pb"),
+              ElementsAre("lib/a.cc:1", "lib/a.cc:30", "lib/b.cc:4"));
+  EXPECT_THAT(get_errors(R"pb(filter {
+                                path_prefix: "lib/"
+                                first_line: 2
+                                last_line: 10
+                              })pb"),
+              ElementsAre("lib/b.cc:4"));
+  EXPECT_THAT(get_errors(R"pb(filter { path: "other.cc" })pb"), IsEmpty());
+}
+
+TEST_F(GimliServiceImplTest, PaginatesErrors) {
+  Report report{.workspace_path = "/some/project"};
+  for (int line = 1; line <= 5; ++line) {
+    report.errors.push_back({.path_in_workspace = "main.cc", .line = line});
+  }
+  reporter_.AddReport(report);
+
+  proto::GetReportRequest request;
+  request.set_path("/some/project");
+  request.set_max_errors(2);
+  std::vector<int> lines;
+  for (int page = 0; page < 3; ++page) {
+    grpc::ClientContext context;
+    proto::GetReportResponse response;
+    ASSERT_TRUE(stub_->GetReport(&context, request, &response).ok());
+    EXPECT_EQ(response.total_errors(), 5);
+    for (const auto& error : response.report().errors()) {
+      lines.push_back(error.line());
+    }
+    EXPECT_EQ(response.has_next_page_token(), page < 2);
+    request.set_page_token(response.next_page_token());
+  }
+  EXPECT_THAT(lines, ElementsAre(1, 2, 3, 4, 5));
+
+  // Once the build changed, the token is rejected.
+  grpc::ClientContext context;
+  proto::GetReportResponse response;
+  request.set_page_token(absl::StrCat(
+    absl::ToUnixNanos(report.time + absl::Seconds(1)), "/2"));
+  EXPECT_EQ(stub_->GetReport(&context, request, &response).error_code(),
+            grpc::StatusCode::FAILED_PRECONDITION);
+}
+
+TEST_F(GimliServiceImplTest, ReturnsChangesSinceKnownVersion) {
+  Report report{.workspace_path = "/some/project",
+                .status = Report::Status::kRunning};
+  report.errors.push_back({.path_in_workspace = "main.cc", .line = 1});
+  reporter_.AddReport(report);
+
+  const auto get_report = [this](std::optional<uint64_t> known_version) {
+    grpc::ClientContext context;
+    proto::GetReportRequest request;
+    proto::GetReportResponse response;
+    request.set_path("/some/project");
+    if (known_version.has_value()) request.set_known_version(*known_version);
+    EXPECT_TRUE(stub_->GetReport(&context, request, &response).ok());
+    return response;
+  };
+  const auto first = get_report(std::nullopt);
+  EXPECT_THAT(first.report().errors(), SizeIs(1));
+
+  // Nothing changed, so the report isn't returned.
+  auto response = get_report(first.version());
+  EXPECT_TRUE(response.not_modified());
+  EXPECT_EQ(response.version(), first.version());
+  EXPECT_FALSE(response.has_report());
+
+  // The build got a new error, which is the only one returned.
+  report.errors.push_back({.path_in_workspace = "main.cc", .line = 2});
+  reporter_.AddReport(report);
+  response = get_report(first.version());
+  EXPECT_FALSE(response.not_modified());
+  EXPECT_TRUE(response.only_new_errors());
+  EXPECT_GT(response.version(), first.version());
+  ASSERT_THAT(response.report().errors(), SizeIs(1));
+  EXPECT_EQ(response.report().errors(0).line(), 2);
+
+  // A new build replaces the report, which is returned whole.
+  report.time += absl::Seconds(1);
+  reporter_.AddReport(report);
+  response = get_report(first.version());
+  EXPECT_FALSE(response.only_new_errors());
+  EXPECT_THAT(response.report().errors(), SizeIs(2));
+}
+
+TEST_F(GimliServiceImplTest, WatchReportReturnsErrorForInvalidRequest) {
+  grpc::ClientContext context;
+  proto::WatchReportRequest request;
+  proto::WatchReportResponse response;
+
+  request.set_path("some/project");
+  auto reader = stub_->WatchReport(&context, request);
+  EXPECT_FALSE(reader->Read(&response));
+  auto status = reader->Finish();
+  ASSERT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+  ASSERT_EQ(status.error_message(), R"(`path` must be absolute)");
+}
+
+TEST_F(GimliServiceImplTest, WatchReportStreamsChanges) {
+  constexpr int64_t kKnownTime = 1764863274;
+  reporter_.AddReport({
+    .workspace_path = "/some/project",
+    .time = absl::FromUnixMicros(kKnownTime),
+    .status = Report::Status::kRunning,
+  });
+
+  grpc::ClientContext context;
+  proto::WatchReportRequest request;
+  proto::WatchReportResponse response;
+
+  request.set_path("/some/project/file.cc");
+  auto reader = stub_->WatchReport(&context, request);
+
+  // The current report is sent first.
+  ASSERT_TRUE(reader->Read(&response));
+  EXPECT_THAT(response,
+              EqualsProto(R"pb(report {
+                                 workspace_path: "/some/project"
+                                 time { seconds: 1764 nanos: 863274000 }
+                                 status: STATUS_RUNNING
+                               })pb"));
+
+  // Errors added to the running build are sent on their own.
+  reporter_.AddReport({
+    .workspace_path = "/some/project",
+    .time = absl::FromUnixMicros(kKnownTime),
+    .errors = {{.path_in_workspace = "main.cc", .line = 5}},
+    .status = Report::Status::kRunning,
+  });
+  ASSERT_TRUE(reader->Read(&response));
+  EXPECT_THAT(response,
+              EqualsProto(R"pb(report {
+                                 workspace_path: "/some/project"
+                                 time { seconds: 1764 nanos: 863274000 }
+                                 errors {
+                                   path_in_workspace: "main.cc"
+                                   line: 5
+                                   message: ""
+                                 }
+                                 status: STATUS_RUNNING
+                               }
+                               only_new_errors: true)pb"));
+
+  // Reports for other workspaces are not sent, and a new build is sent whole.
+  reporter_.AddReport({.workspace_path = "/some/other"});
+  reporter_.AddReport({.workspace_path = "/some/project"});
+  ASSERT_TRUE(reader->Read(&response));
+  EXPECT_THAT(response,
+              EqualsProto(R"pb(report {
+                                 workspace_path: "/some/project"
+                                 time {}
+                                 status: STATUS_FINISHED
                                })pb"));
+
+  context.TryCancel();
+  EXPECT_FALSE(reader->Read(&response));
+  EXPECT_EQ(reader->Finish().error_code(), grpc::StatusCode::CANCELLED);
+}
+
+TEST_F(GimliServiceImplTest, ReturnsStats) {
+  metrics_.AddCounter("events_total", "Events.", {{"payload", "progress"}})
+    .Increment(3);
+  metrics_.AddHistogram("latency_seconds", "Latency.", /*scale=*/0.5)
+    .Record(4);
+
+  grpc::ClientContext context;
+  proto::GetStatsRequest request;
+  proto::GetStatsResponse response;
+  ASSERT_TRUE(stub_->GetStats(&context, request, &response).ok());
+  EXPECT_THAT(response,
+              EqualsProto(R"pb(metrics {
+                                 name: "events_total"
+                                 help: "Events."
+                                 labels { key: "payload" value: "progress" }
+                                 counter: 3
+                               }
+                               metrics {
+                                 name: "latency_seconds"
+                                 help: "Latency."
+                                 histogram {
+                                   count: 1
+                                   sum: 2
+                                   max: 2
+                                   p50: 2
+                                   p90: 2
+                                   p99: 2
+                                   buckets { max_value: 2 count: 1 }
+                                 }
+                               })pb"));
+
+  grpc::ClientContext text_context;
+  proto::GetStatsResponse text_response;
+  request.set_prometheus_text(true);
+  ASSERT_TRUE(stub_->GetStats(&text_context, request, &text_response).ok());
+  EXPECT_THAT(text_response.prometheus_text(),
+              HasSubstr(R"(events_total{payload="progress"} 3)"));
 }
 
 }  // namespace
@@ -0,0 +1,265 @@
+#include "gimli/metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/any_invocable.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_cat.h"
+
+namespace gimli {
+namespace {
+
+// Returns the shortest text which parses back to `value`.
+std::string FormatNumber(double value) {
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  char buffer[32];
+  const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  return std::string(buffer, result.ptr);
+}
+
+// Escapes the backslashes, double quotes (if `quotes`) and line feeds.
+std::string Escape(std::string_view text, bool quotes) {
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (const char c : text) {
+    if (c == '\\' || (quotes && c == '"')) {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (c == '\n') {
+      escaped.append("\\n");
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+// Appends a line for `name` with `labels`, and `le` if not empty.
+void AppendLine(std::string& text, std::string_view name,
+                const Metrics::Labels& labels, std::string_view le,
+                double value) {
+  text.append(name);
+  if (!labels.empty() || !le.empty()) {
+    text.push_back('{');
+    std::string_view separator;
+    for (const auto& [key, label] : labels) {
+      absl::StrAppend(&text, separator, key, "=\"", Escape(label, true), "\"");
+      separator = ",";
+    }
+    if (!le.empty()) absl::StrAppend(&text, separator, "le=\"", le, "\"");
+    text.push_back('}');
+  }
+  absl::StrAppend(&text, " ", FormatNumber(value), "\n");
+}
+
+std::string_view TypeName(Metrics::Type type) {
+  switch (type) {
+    case Metrics::Type::kCounter:
+      return "counter";
+    case Metrics::Type::kGauge:
+      return "gauge";
+    case Metrics::Type::kHistogram:
+      return "histogram";
+  }
+  return "untyped";
+}
+
+}  // namespace
+
+uint64_t Histogram::Snapshot::ValueAt(double q) const {
+  if (count == 0) return 0;
+  const auto rank = std::max<uint64_t>(
+    1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (const auto& [value, bucket_count] : buckets) {
+    seen += bucket_count;
+    // The largest value recorded is known exactly.
+    if (seen >= rank) return std::min(value, max);
+  }
+  return max;
+}
+
+size_t Histogram::BucketOf(uint64_t value) {
+  constexpr uint64_t kExact = uint64_t{2} << kSubBucketBits;
+  if (value < kExact) return value;
+  const int exponent = absl::bit_width(value) - 1;
+  const int shift = exponent - kSubBucketBits;
+  // The leading bits, which are in [2^kSubBucketBits, 2^(kSubBucketBits+1)).
+  const uint64_t leading = value >> shift;
+  return (static_cast<size_t>(shift + 1) << kSubBucketBits) + leading -
+         (uint64_t{1} << kSubBucketBits);
+}
+
+uint64_t Histogram::MaxValueOf(size_t bucket) {
+  constexpr size_t kExact = size_t{2} << kSubBucketBits;
+  if (bucket < kExact) return bucket;
+  const int shift = static_cast<int>(bucket >> kSubBucketBits) - 1;
+  constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+  const uint64_t leading = (bucket & (kSubBuckets - 1)) + kSubBuckets;
+  // Wraps around to the maximum for the last bucket.
+  return ((leading + 1) << shift) - 1;
+}
+
+void Histogram::Record(uint64_t value) {
+  counts_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+Histogram::Snapshot Histogram::GetSnapshot() const {
+  Snapshot snapshot{
+    .sum = sum_.load(std::memory_order_relaxed),
+    .max = max_.load(std::memory_order_relaxed),
+  };
+  // The count is the one of the buckets, so quantiles are consistent even if
+  // values are recorded meanwhile.
+  for (size_t i = 0; i < kBuckets; ++i) {
+    const uint64_t count = counts_[i].load(std::memory_order_relaxed);
+    if (count == 0) continue;
+    snapshot.count += count;
+    snapshot.buckets.emplace_back(MaxValueOf(i), count);
+  }
+  return snapshot;
+}
+
+void Metrics::Add(Metric metric) {
+  std::scoped_lock lock(mutex_);
+  metrics_.push_back(std::move(metric));
+}
+
+Counter& Metrics::AddCounter(std::string_view name, std::string_view help,
+                             Labels labels) {
+  auto counter = std::make_unique<Counter>();
+  Counter& added = *counter;
+  Add({
+    .name = std::string(name),
+    .help = std::string(help),
+    .labels = std::move(labels),
+    .type = Type::kCounter,
+    .counter = std::move(counter),
+  });
+  return added;
+}
+
+Gauge& Metrics::AddGauge(std::string_view name, std::string_view help,
+                         Labels labels) {
+  auto gauge = std::make_unique<Gauge>();
+  Gauge& added = *gauge;
+  Add({
+    .name = std::string(name),
+    .help = std::string(help),
+    .labels = std::move(labels),
+    .type = Type::kGauge,
+    .gauge = std::move(gauge),
+  });
+  return added;
+}
+
+void Metrics::AddComputedGauge(std::string_view name, std::string_view help,
+                               absl::AnyInvocable<int64_t() const> value) {
+  Add({
+    .name = std::string(name),
+    .help = std::string(help),
+    .type = Type::kGauge,
+    .gauge_function = std::move(value),
+  });
+}
+
+Histogram& Metrics::AddHistogram(std::string_view name, std::string_view help,
+                                 double scale, Labels labels) {
+  auto histogram = std::make_unique<Histogram>();
+  Histogram& added = *histogram;
+  Add({
+    .name = std::string(name),
+    .help = std::string(help),
+    .labels = std::move(labels),
+    .type = Type::kHistogram,
+    .scale = scale,
+    .histogram = std::move(histogram),
+  });
+  return added;
+}
+
+std::vector<Metrics::Sample> Metrics::Collect() const {
+  std::scoped_lock lock(mutex_);
+  std::vector<Sample> samples;
+  samples.reserve(metrics_.size());
+  for (const auto& metric : metrics_) {
+    Sample& sample = samples.emplace_back(Sample{
+      .name = metric.name,
+      .help = metric.help,
+      .labels = metric.labels,
+      .type = metric.type,
+      .scale = metric.scale,
+    });
+    if (metric.counter != nullptr) {
+      sample.value = static_cast<double>(metric.counter->value());
+    } else if (metric.gauge != nullptr) {
+      sample.value = static_cast<double>(metric.gauge->value());
+    } else if (metric.gauge_function != nullptr) {
+      sample.value = static_cast<double>(metric.gauge_function());
+    } else if (metric.histogram != nullptr) {
+      sample.histogram = metric.histogram->GetSnapshot();
+    }
+  }
+  return samples;
+}
+
+std::string Metrics::ToPrometheusText(const std::vector<Sample>& samples) {
+  // Samples of the same metric must be grouped, after its help and type.
+  std::vector<const Sample*> sorted;
+  sorted.reserve(samples.size());
+  for (const auto& sample : samples) sorted.push_back(&sample);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Sample* a, const Sample* b) {
+                     return a->name < b->name;
+                   });
+
+  std::string text;
+  std::string_view previous_name;
+  for (const Sample* sample : sorted) {
+    if (sample->name != previous_name) {
+      absl::StrAppend(&text, "# HELP ", sample->name, " ",
+                      Escape(sample->help, false), "\n", "# TYPE ",
+                      sample->name, " ", TypeName(sample->type), "\n");
+      previous_name = sample->name;
+    }
+    if (sample->type != Type::kHistogram) {
+      AppendLine(text, sample->name, sample->labels, "", sample->value);
+      continue;
+    }
+    // Buckets are cumulative in Prometheus. Only the nonempty ones are
+    // listed, as the hundreds of others would add nothing.
+    const auto& histogram = sample->histogram;
+    const std::string bucket_name = absl::StrCat(sample->name, "_bucket");
+    uint64_t cumulative = 0;
+    for (const auto& [value, count] : histogram.buckets) {
+      cumulative += count;
+      AppendLine(text, bucket_name, sample->labels,
+                 FormatNumber(static_cast<double>(value) * sample->scale),
+                 static_cast<double>(cumulative));
+    }
+    AppendLine(text, bucket_name, sample->labels, "+Inf",
+               static_cast<double>(histogram.count));
+    AppendLine(text, absl::StrCat(sample->name, "_sum"), sample->labels, "",
+               static_cast<double>(histogram.sum) * sample->scale);
+    AppendLine(text, absl::StrCat(sample->name, "_count"), sample->labels, "",
+               static_cast<double>(histogram.count));
+  }
+  return text;
+}
+
+}  // namespace gimli
@@ -0,0 +1,157 @@
+#ifndef GIMLI_METRICS_H_
+#define GIMLI_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/any_invocable.h"
+
+namespace gimli {
+
+// A count that only goes up, like events received. Incrementing it is a
+// relaxed atomic addition, cheap enough to do for every event.
+class Counter {
+ public:
+  void Increment(uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_ = 0;
+};
+
+// A value that goes up and down, like the number of active streams.
+class Gauge {
+ public:
+  void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_ = 0;
+};
+
+// A distribution of values, like latencies in nanoseconds. As in HDR
+// histograms, buckets are log-linear: each power of two is split in 8, so a
+// value is known within 12.5% whatever its magnitude, in a fixed memory.
+class Histogram {
+ public:
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    // The largest value and the count of the nonempty buckets, in increasing
+    // order of values.
+    std::vector<std::pair<uint64_t, uint64_t>> buckets;
+
+    // Returns the largest value of the bucket with the quantile `q` (in
+    // [0, 1]), or 0 if the histogram is empty.
+    uint64_t ValueAt(double q) const;
+  };
+
+  void Record(uint64_t value);
+  Snapshot GetSnapshot() const;
+
+  // Returns the bucket of `value`, and the largest value of a bucket.
+  static size_t BucketOf(uint64_t value);
+  static uint64_t MaxValueOf(size_t bucket);
+
+ private:
+  static constexpr int kSubBucketBits = 3;
+  // Values below twice the sub-buckets have their own bucket.
+  static constexpr size_t kBuckets = (64 - kSubBucketBits + 1)
+                                     << kSubBucketBits;
+
+  std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+  std::atomic<uint64_t> sum_ = 0;
+  std::atomic<uint64_t> max_ = 0;
+};
+
+// Records the lifetime of the timer in `histogram`, in nanoseconds.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram& histogram)
+    : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+  ~ScopedTimer() {
+    histogram_.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count());
+  }
+
+ private:
+  Histogram& histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// The metrics of a server, which are registered once and then updated
+// without locking. Metrics of the same name only differ by their labels.
+class Metrics {
+ public:
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+
+  enum class Type { kCounter, kGauge, kHistogram };
+
+  // The value of a metric when collected. Histogram values are multiplied by
+  // `scale`, e.g. to export nanoseconds as seconds.
+  struct Sample {
+    std::string name;
+    std::string help;
+    Labels labels;
+    Type type = Type::kCounter;
+    double value = 0;
+    double scale = 1;
+    Histogram::Snapshot histogram;
+  };
+
+  // The returned metrics live as long as this object.
+  Counter& AddCounter(std::string_view name, std::string_view help,
+                      Labels labels = {});
+  Gauge& AddGauge(std::string_view name, std::string_view help,
+                  Labels labels = {});
+  // Adds a gauge whose value is computed when collected.
+  void AddComputedGauge(std::string_view name, std::string_view help,
+                        absl::AnyInvocable<int64_t() const> value);
+  Histogram& AddHistogram(std::string_view name, std::string_view help,
+                          double scale = 1, Labels labels = {});
+
+  // Returns the samples of all the metrics, in the order of registration.
+  std::vector<Sample> Collect() const;
+
+  // Returns the samples in the Prometheus text exposition format.
+  static std::string ToPrometheusText(const std::vector<Sample>& samples);
+
+ private:
+  struct Metric {
+    std::string name;
+    std::string help;
+    Labels labels;
+    Type type;
+    double scale = 1;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    absl::AnyInvocable<int64_t() const> gauge_function;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  // Registers `metric`, which is complete as `Collect` may read it as soon
+  // as the lock is released.
+  void Add(Metric metric);
+
+  mutable std::mutex mutex_;
+  std::vector<Metric> metrics_;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_METRICS_H_
@@ -0,0 +1,126 @@
+#include "gimli/metrics.h"
+
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gimli {
+namespace {
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::Pair;
+using ::testing::SizeIs;
+
+TEST(HistogramTest, BucketsAreExactForSmallValues) {
+  for (uint64_t value = 0; value < 16; ++value) {
+    EXPECT_EQ(Histogram::MaxValueOf(Histogram::BucketOf(value)), value);
+  }
+}
+
+TEST(HistogramTest, BucketsHaveBoundedRelativeError) {
+  for (uint64_t value = 16; value < 1'000'000; value += value / 7) {
+    const size_t bucket = Histogram::BucketOf(value);
+    const uint64_t max_value = Histogram::MaxValueOf(bucket);
+    EXPECT_GE(max_value, value);
+    EXPECT_LE(max_value - value, value / 8);
+    // The buckets are contiguous.
+    EXPECT_EQ(Histogram::BucketOf(max_value), bucket);
+    EXPECT_EQ(Histogram::BucketOf(max_value + 1), bucket + 1);
+  }
+  const uint64_t largest = std::numeric_limits<uint64_t>::max();
+  EXPECT_EQ(Histogram::MaxValueOf(Histogram::BucketOf(largest)), largest);
+}
+
+TEST(HistogramTest, ComputesQuantiles) {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value) histogram.Record(value);
+
+  const auto snapshot = histogram.GetSnapshot();
+  EXPECT_EQ(snapshot.count, 1000);
+  EXPECT_EQ(snapshot.sum, 500500);
+  EXPECT_EQ(snapshot.max, 1000);
+  EXPECT_NEAR(snapshot.ValueAt(0.5), 500, 500 / 8);
+  EXPECT_NEAR(snapshot.ValueAt(0.99), 990, 990 / 8);
+  EXPECT_EQ(snapshot.ValueAt(1), 1000);
+  EXPECT_EQ(Histogram().GetSnapshot().ValueAt(0.5), 0);
+}
+
+TEST(HistogramTest, RecordsConcurrently) {
+  Histogram histogram;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&histogram]() {
+      for (uint64_t value = 0; value < 1000; ++value) histogram.Record(value);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  const auto snapshot = histogram.GetSnapshot();
+  EXPECT_EQ(snapshot.count, 4000);
+  EXPECT_EQ(snapshot.max, 999);
+}
+
+TEST(MetricsTest, CollectsInOrderOfRegistration) {
+  Metrics under_test;
+  auto& counter = under_test.AddCounter("events_total", "Events.",
+                                        {{"payload", "progress"}});
+  auto& gauge = under_test.AddGauge("streams", "Streams.");
+  under_test.AddComputedGauge("reports", "Reports.", []() { return 42; });
+  auto& histogram = under_test.AddHistogram("latency_seconds", "Latency.",
+                                            /*scale=*/1e-9);
+  counter.Increment(3);
+  gauge.Add(2);
+  gauge.Add(-1);
+  histogram.Record(1000);
+
+  const auto samples = under_test.Collect();
+  ASSERT_THAT(samples, SizeIs(4));
+  EXPECT_EQ(samples[0].name, "events_total");
+  EXPECT_THAT(samples[0].labels, ElementsAre(Pair("payload", "progress")));
+  EXPECT_EQ(samples[0].value, 3);
+  EXPECT_EQ(samples[1].value, 1);
+  EXPECT_EQ(samples[2].value, 42);
+  EXPECT_EQ(samples[3].type, Metrics::Type::kHistogram);
+  EXPECT_EQ(samples[3].histogram.count, 1);
+}
+
+TEST(MetricsTest, FormatsPrometheusText) {
+  Metrics under_test;
+  under_test.AddCounter("events_total", "Events.", {{"payload", "started"}})
+    .Increment();
+  under_test.AddGauge("streams", "Active \"streams\".");
+  under_test.AddCounter("events_total", "Events.", {{"payload", "progress"}})
+    .Increment(2);
+  under_test.AddHistogram("latency_seconds", "Latency.", /*scale=*/0.5)
+    .Record(4);
+
+  EXPECT_EQ(Metrics::ToPrometheusText(under_test.Collect()),
+            R"(# HELP events_total Events.
+# TYPE events_total counter
+events_total{payload="started"} 1
+events_total{payload="progress"} 2
+# HELP latency_seconds Latency.
+# TYPE latency_seconds histogram
+latency_seconds_bucket{le="2"} 1
+latency_seconds_bucket{le="+Inf"} 1
+latency_seconds_sum 2
+latency_seconds_count 1
+# HELP streams Active "streams".
+# TYPE streams gauge
+streams 0
+)");
+}
+
+TEST(MetricsTest, EscapesLabels) {
+  Metrics under_test;
+  under_test.AddCounter("total", "Help\\", {{"path", "a\"b\\c\nd"}});
+  EXPECT_THAT(Metrics::ToPrometheusText(under_test.Collect()),
+              HasSubstr(R"(total{path="a\"b\\c\nd"} 0)"));
+}
+
+}  // namespace
+}  // namespace gimli
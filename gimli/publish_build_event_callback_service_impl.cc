@@ -1,24 +1,40 @@
 #include "gimli/publish_build_event_callback_service_impl.h"
 
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "absl/base/nullability.h"
-#include "absl/cleanup/cleanup.h"
+#include "absl/functional/any_invocable.h"
 #include "absl/log/log.h"
-#include "absl/strings/match.h"
-#include "absl/strings/strip.h"
-#include "gimli/recording.pb.h"
+#include "absl/log/vlog_is_on.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/build_event_decoder.h"
+#include "gimli/metrics.h"
+#include "gimli/recording_file.h"
 #include "gimli/report.h"
 #include "gimli/reporter.h"
+#include "gimli/tracer.h"
+#include "gimli/worker_pool.h"
 #include "google/devtools/build/v1/build_events.pb.h"
 #include "google/devtools/build/v1/publish_build_event.pb.h"
 #include "google/protobuf/any.pb.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/descriptor.h"
-#include "google/protobuf/text_format.h"
 #include "google/protobuf/util/time_util.h"
 #include "grpcpp/server_context.h"
 #include "grpcpp/support/server_callback.h"
@@ -34,6 +50,20 @@ using ::google::devtools::build::v1::PublishBuildToolEventStreamResponse;
 using ::google::devtools::build::v1::PublishLifecycleEventRequest;
 using ::google::protobuf::util::TimeUtil;
 
+// Minimum interval between two publications of a running build's report.
+constexpr absl::Duration kPublishInterval = absl::Seconds(1);
+
+// Maximum number of requests of a stream waiting for the workers, after which
+// the stream is no longer read until they catch up.
+constexpr int kMaxPendingRequests = 64;
+
+// Maximum number of acknowledgements of a stream waiting to be written, after
+// which the stream is no longer read until the client reads them.
+constexpr size_t kMaxPendingAcks = 64;
+
+// Size of the initial block of the acknowledgements, enough for dozens.
+constexpr size_t kAcksInitialBlockSize = 4096;
+
 std::string_view PayloadName(BuildEvent::PayloadCase payload) {
   const auto* message_descriptor = BuildEvent::descriptor();
   const auto* field_descriptor = message_descriptor->FindFieldByNumber(payload);
@@ -46,11 +76,119 @@ std::string_view IdName(BuildEventId::IdCase id) {
   return (field_descriptor == nullptr) ? "Unknown" : field_descriptor->name();
 }
 
+// Whether the invocation id, which names the recording, matches
+// `[A-Za-z0-9_-]+`, so it can't escape the testdata directory.
+bool IsValidInvocationId(std::string_view invocation_id) {
+  return !invocation_id.empty() &&
+         std::all_of(invocation_id.begin(), invocation_id.end(), [](char c) {
+           return absl::ascii_isalnum(c) || c == '_' || c == '-';
+         });
+}
+
+// Scale of the latency histograms, which are recorded in nanoseconds and
+// exported in seconds.
+constexpr double kNanosToSeconds = 1e-9;
+
+// Finishes a stream which isn't admitted, without reading it.
+class RejectedReactor final
+  : public grpc::ServerBidiReactor<PublishBuildToolEventStreamRequest,
+                                   PublishBuildToolEventStreamResponse> {
+ public:
+  explicit RejectedReactor(grpc::Status status) { Finish(std::move(status)); }
+
+  void OnDone() final { delete this; }
+};
+
 }  // namespace
 
+PublishBuildEventCallbackServiceImpl::StreamMetrics
+PublishBuildEventCallbackServiceImpl::RegisterMetrics(Metrics& metrics) {
+  constexpr std::string_view kEvents = "gimli_events_total";
+  constexpr std::string_view kEventsHelp = "Build events received.";
+  constexpr std::string_view kRejected = "gimli_rejected_streams_total";
+  constexpr std::string_view kRejectedHelp =
+    "Build event streams rejected, as a limit was reached.";
+  StreamMetrics stream_metrics{
+    .other_events = &metrics.AddCounter(kEvents, kEventsHelp,
+                                        {{"payload", "unknown"}}),
+    .stderr_bytes = &metrics.AddCounter(
+      "gimli_stderr_bytes_total", "Bytes of stderr parsed for errors."),
+    .any_unpack = &metrics.AddHistogram(
+      "gimli_any_unpack_seconds", "Time to decode the Any of a build event.",
+      kNanosToSeconds),
+    .stderr_to_errors = &metrics.AddHistogram(
+      "gimli_stderr_to_errors_seconds",
+      "Time to extract the errors of a stderr chunk.", kNanosToSeconds),
+    .ack_write = &metrics.AddHistogram(
+      "gimli_ack_write_seconds", "Time to write an acknowledgement.",
+      kNanosToSeconds),
+    .active_streams = &metrics.AddGauge("gimli_active_streams",
+                                        "Build event streams in progress."),
+    .inflight_bytes = &metrics.AddGauge(
+      "gimli_inflight_bytes",
+      "Bytes of the build events waiting to be processed, and of the state "
+      "kept by the streams."),
+    .rejected_for_streams = &metrics.AddCounter(
+      kRejected, kRejectedHelp, {{"reason", "streams"}}),
+    .rejected_for_memory = &metrics.AddCounter(kRejected, kRejectedHelp,
+                                               {{"reason", "memory"}}),
+    .dropped_errors = &metrics.AddCounter(
+      "gimli_dropped_errors_total",
+      "Errors not kept, as their report has too many."),
+  };
+  // Counters are registered upfront for all payloads, so counting an event
+  // is only an index and an atomic increment.
+  const auto* payload = BuildEvent::descriptor()->FindOneofByName("payload");
+  for (int i = 0; i < payload->field_count(); ++i) {
+    const auto* field = payload->field(i);
+    if (static_cast<size_t>(field->number()) >= stream_metrics.events.size()) {
+      stream_metrics.events.resize(field->number() + 1);
+    }
+    stream_metrics.events[field->number()] = &metrics.AddCounter(
+      kEvents, kEventsHelp, {{"payload", std::string(field->name())}});
+  }
+  return stream_metrics;
+}
+
+void PublishBuildEventCallbackServiceImpl::StreamMetrics::CountEvent(
+  int payload_case) const {
+  Counter* absl_nullable counter =
+    payload_case >= 0 && static_cast<size_t>(payload_case) < events.size()
+      ? events[payload_case]
+      : nullptr;
+  (counter == nullptr ? other_events : counter)->Increment();
+}
+
 PublishBuildEventCallbackServiceImpl::PublishBuildEventCallbackServiceImpl(
-  Reporter& reporter, std::optional<std::filesystem::path> testdata)
-  : reporter_(&reporter), testdata_(std::move(testdata)) {}
+  Reporter& reporter, Metrics& metrics, Tracer* absl_nullable tracer,
+  std::optional<std::filesystem::path> testdata, int num_workers,
+  StreamLimits limits)
+  : reporter_(&reporter),
+    metrics_(RegisterMetrics(metrics)),
+    tracer_(tracer),
+    limits_(limits),
+    testdata_(std::move(testdata)),
+    workers_(num_workers) {}
+
+grpc::Status PublishBuildEventCallbackServiceImpl::Admit() {
+  // Streams already admitted keep going: their memory is bounded by the
+  // backpressure on each of them.
+  if (limits_.max_inflight_bytes > 0 &&
+      static_cast<size_t>(std::max<int64_t>(
+        metrics_.inflight_bytes->value(), 0)) >= limits_.max_inflight_bytes) {
+    metrics_.rejected_for_memory->Increment();
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                        "Too many build events waiting to be processed");
+  }
+  const int active = active_streams_.fetch_add(1, std::memory_order_relaxed);
+  if (limits_.max_streams > 0 && active >= limits_.max_streams) {
+    active_streams_.fetch_sub(1, std::memory_order_relaxed);
+    metrics_.rejected_for_streams->Increment();
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                        "Too many build event streams");
+  }
+  return grpc::Status::OK;
+}
 
 grpc::ServerUnaryReactor*
 PublishBuildEventCallbackServiceImpl::PublishLifecycleEvent(
@@ -68,81 +206,171 @@ grpc::ServerBidiReactor<PublishBuildToolEventStreamRequest,
                         PublishBuildToolEventStreamResponse>*
 PublishBuildEventCallbackServiceImpl::PublishBuildToolEventStream(
   grpc::CallbackServerContext* context) {
-  class Reactor final
-    : public grpc::ServerBidiReactor<PublishBuildToolEventStreamRequest,
-                                     PublishBuildToolEventStreamResponse> {
+  // The processing of the events of a stream, which is done by the workers,
+  // so a slow event doesn't delay the acknowledgements of other streams.
+  class StreamState final {
    public:
-    Reactor(Reporter* absl_nonnull reporter,
-            const StderrProcessor* absl_nonnull stderr_processor,
-            std::optional<std::filesystem::path> testdata)
+    StreamState(Reporter* absl_nonnull reporter,
+                const StreamMetrics* absl_nonnull metrics,
+                Tracer* absl_nullable tracer, uint64_t stream_id,
+                const StreamLimits* absl_nonnull limits,
+                const StderrProcessor* absl_nonnull stderr_processor,
+                std::optional<std::filesystem::path> testdata)
       : reporter_(reporter),
-        stderr_processor_(stderr_processor),
-        testdata_(std::move(testdata)) {
-      StartRead(&request_);
+        metrics_(metrics),
+        tracer_(tracer),
+        stream_id_(stream_id),
+        limits_(limits),
+        stderr_stream_(stderr_processor),
+        testdata_(std::move(testdata)) {}
+
+    // Counts a request of `bytes` that the reactor posts for processing.
+    void AddPending(size_t bytes) {
+      metrics_->inflight_bytes->Add(static_cast<int64_t>(bytes));
+      std::scoped_lock lock(mutex_);
+      ++pending_;
+      pending_bytes_ += bytes;
     }
 
-    void OnReadDone(bool ok) final {
-      if (testdata_.has_value()) {
-        *recording_.add_requests() = request_;
+    // Calls `read` right away if few requests are pending, otherwise once
+    // the workers caught up. This is the backpressure on the client.
+    void ReadWhenReady(absl::AnyInvocable<void() &&> read) {
+      {
+        std::scoped_lock lock(mutex_);
+        if (IsBacklogged()) {
+          delayed_read_ = std::move(read);
+          return;
+        }
       }
-      // The protocol (not very well documented) seems to be that the service
-      // must respond with the "identifiers" (stream id and sequence numnber)
-      // of the request, so the caller knows they have been acknowledged.
-      //
-      // The request will be processed once this response is written, because
-      // the request's contents will drive the termination or continuation of
-      // the streaming RPC call.
-      *response_.mutable_stream_id() =
-        request_.ordered_build_event().stream_id();
-      response_.set_sequence_number(
-        request_.ordered_build_event().sequence_number());
-      StartWrite(&response_);
+      std::move(read)();
     }
 
-    void OnWriteDone(bool ok) final {
-      const auto& build_event = request_.ordered_build_event().event();
-      if (build_event.has_component_stream_finished()) {
-        Finish(grpc::Status::OK);
-        return;
+    // Processes a request of `bytes`, counted by `AddPending`.
+    void Process(const PublishBuildToolEventStreamRequest& request,
+                 size_t bytes) {
+      if (invocation_id_.empty()) {
+        invocation_id_ =
+          request.ordered_build_event().stream_id().invocation_id();
       }
-      Process(build_event.bazel_event());
-      StartRead(&request_);
+      if (testdata_.has_value()) Record(request);
+      Process(request.ordered_build_event().event().bazel_event());
+
+      metrics_->inflight_bytes->Add(-static_cast<int64_t>(bytes));
+      absl::AnyInvocable<void() &&> read;
+      {
+        std::scoped_lock lock(mutex_);
+        --pending_;
+        pending_bytes_ -= bytes;
+        if (delayed_read_ == nullptr || IsBacklogged()) return;
+        read = std::move(delayed_read_);
+        delayed_read_ = nullptr;
+      }
+      std::move(read)();
     }
 
-    void OnDone() final {
-      auto _ = absl::MakeCleanup([&]() { delete this; });
+    // Called once the stream is done.
+    void Finish() {
+      // The stream is done, so the last error of stderr is complete.
+      AddErrors(stderr_stream_.Finish());
+      AccountRetained(0);
       if (report_.has_value()) {
+        report_->status = Report::Status::kFinished;
+        Tracer::Span span(tracer_, "publish", stream_id_);
         reporter_->AddReport(*std::move(report_));
       }
 
-      if (!testdata_.has_value()) return;
-      if (auto size = labels_.size(); size != 1) {
-        LOG(ERROR) << "⏺️ Recording only works for 1 target, got " << size;
+      if (!recording_.has_value()) return;
+      if (auto status = recording_->Close(); !status.ok()) {
+        LOG(ERROR) << "⏺️ Recording failed: " << status;
         return;
       }
-      std::string_view label = labels_.front();
-      static constexpr std::string_view kPackage = "//gimli/testdata:";
-      if (!absl::StartsWith(label, kPackage)) {
-        LOG(ERROR) << "⏺️ Recording only works for target in " << kPackage
-                   << ", got " << label;
-        return;
+      LOG(INFO) << "⏺️ Recorded " << recording_->path();
+    }
+
+   private:
+    // Whether the workers fell behind. Must be called with `mutex_` held.
+    bool IsBacklogged() const {
+      return pending_ >= kMaxPendingRequests ||
+             (limits_->max_stream_bytes > 0 &&
+              pending_bytes_ >= limits_->max_stream_bytes);
+    }
+
+    // Appends the request to the recording, which is created on the first
+    // request, and named after the invocation. Invocations with an invalid
+    // id are not recorded.
+    void Record(const PublishBuildToolEventStreamRequest& request) {
+      if (!recording_.has_value()) {
+        const auto& invocation_id =
+          request.ordered_build_event().stream_id().invocation_id();
+        if (!IsValidInvocationId(invocation_id)) {
+          LOG(ERROR) << "⏺️ Recording failed, invalid invocation id: "
+                     << invocation_id;
+          testdata_.reset();
+          return;
+        }
+        const auto path = *testdata_ / absl::StrCat(invocation_id, ".binpb");
+        auto file = RecordingFile::Create(path);
+        if (!file.ok()) {
+          LOG(ERROR) << "⏺️ Recording failed: " << file.status();
+          testdata_.reset();
+          return;
+        }
+        recording_ = *std::move(file);
       }
-      const auto path = (*testdata_ / absl::StripPrefix(label, kPackage))
-                          .replace_extension(".textproto");
+      recording_->Append(request);
+    }
 
-      std::string contents;
-      if (!google::protobuf::TextFormat::PrintToString(recording_, &contents)) {
-        LOG(ERROR) << "⏺️ Recording failed, couldn't print to text format";
-        return;
+    void Process(const google::protobuf::Any& bazel_event) {
+      // Logging and recording need whole events, which are otherwise never
+      // parsed: only the few fields used are decoded.
+      Tracer::Span span(tracer_, "process", stream_id_);
+      if (VLOG_IS_ON(1) || testdata_.has_value()) LogAndRecord(bazel_event);
+      BuildEventDecoder::Event event;
+      bool decoded;
+      {
+        Tracer::Span unpack_span(tracer_, "unpack", stream_id_);
+        ScopedTimer timer(*metrics_->any_unpack);
+        decoded = decoder_.Decode(bazel_event, event);
       }
+      metrics_->CountEvent(decoded ? event.payload_case
+                                   : BuildEvent::PAYLOAD_NOT_SET);
+      if (!decoded) return;
 
-      std::fstream stream(path, std::ios::out | std::ios::trunc);
-      stream << contents;
-      LOG(INFO) << "⏺️ Recorded " << path;
+      if (event.payload_case == BuildEvent::kStarted) {
+        report_ = Report{
+          .workspace_path = event.workspace_directory,
+          .invocation_id = invocation_id_,
+          // The precision of timestamp is in nanoseconds so we use that
+          // to convert from protobuf timestamp to absl::Time.
+          .time = absl::FromUnixNanos(
+            TimeUtil::TimestampToNanoseconds(event.start_time)),
+          .status = Report::Status::kRunning,
+        };
+        VLOG(1) << " 🔨 in " << event.workspace_directory;
+        // Publish right away, so the report of a previous build is replaced.
+        Publish();
+      }
+      if (event.payload_case == BuildEvent::kProgress) {
+        // Stderr is chunked across progress events, so it's always given to
+        // the stream, which keeps the lines and errors that straddle chunks.
+        metrics_->stderr_bytes->Increment(event.stderr.size());
+        std::vector<Report::Error> errors;
+        {
+          Tracer::Span stderr_span(tracer_, "stderr_parse", stream_id_);
+          ScopedTimer timer(*metrics_->stderr_to_errors);
+          errors = stderr_stream_.Append(event.stderr);
+        }
+        AddErrors(std::move(errors));
+        AccountRetained(stderr_stream_.HeapBytes());
+        // Publishing copies the whole report, so it's throttled.
+        if (has_unpublished_errors_ &&
+            absl::Now() - last_publish_time_ >= kPublishInterval) {
+          Publish();
+        }
+      }
     }
 
-   private:
-    void Process(const google::protobuf::Any& bazel_event) {
+    void LogAndRecord(const google::protobuf::Any& bazel_event) {
       BuildEvent build_event;
       if (!bazel_event.UnpackTo(&build_event)) return;
       // Log the events if vlog is enabled via `--vmodule=gimli_server=1`.
@@ -153,46 +381,275 @@ PublishBuildEventCallbackServiceImpl::PublishBuildToolEventStream(
       for (const auto& child : build_event.children()) {
         VLOG(1) << "  🐶" << IdName(child.id_case());
       }
-      // If in recording mode, save the build event and the configured targets
-      if (testdata_.has_value()) {
-        *recording_.add_build_events() = build_event;
-        if (build_event.payload_case() == BuildEvent::kConfigured) {
-          labels_.push_back(build_event.id().target_configured().label());
-        }
-      }
+      // If in recording mode, save the build event.
+      if (recording_.has_value()) recording_->Append(build_event);
+    }
 
-      if (build_event.payload_case() == BuildEvent::kStarted) {
-        report_ = Report{
-          .workspace_path = build_event.started().workspace_directory(),
-          // The precision of timestamp is in nanoseconds so we use that
-          // to convert from protobuf timestamp to absl::Time.
-          .time = absl::FromUnixNanos(TimeUtil::TimestampToNanoseconds(
-            build_event.started().start_time())),
-        };
-        VLOG(1) << " 🔨 in " << build_event.started().workspace_directory();
-      }
-      if (build_event.payload_case() == BuildEvent::kProgress) {
-        if (report_.has_value()) {
-          for (auto&& error :
-               stderr_processor_->ToErrors(build_event.progress().stderr())) {
-            report_->errors.push_back(std::move(error));
-          }
-        }
+    // Accounts `bytes` kept by the stream between requests, which replace
+    // the previously accounted ones, in the inflight bytes.
+    void AccountRetained(size_t bytes) {
+      metrics_->inflight_bytes->Add(static_cast<int64_t>(bytes) -
+                                    static_cast<int64_t>(retained_bytes_));
+      retained_bytes_ = bytes;
+    }
+
+    // Publishes a snapshot of the report while the build is running.
+    void Publish() {
+      if (!report_.has_value()) return;
+      Tracer::Span span(tracer_, "publish", stream_id_);
+      reporter_->AddReport(*report_);
+      last_publish_time_ = absl::Now();
+      has_unpublished_errors_ = false;
+    }
+
+    void AddErrors(std::vector<Report::Error> errors) {
+      if (!report_.has_value()) return;
+      // Beyond the limit, errors are dropped, so a build with runaway errors
+      // doesn't take the memory of the others.
+      const size_t max_errors = limits_->max_errors_per_report;
+      size_t kept = errors.size();
+      if (max_errors > 0) {
+        const size_t room = report_->errors.size() < max_errors
+                              ? max_errors - report_->errors.size()
+                              : 0;
+        kept = std::min(kept, room);
+        metrics_->dropped_errors->Increment(errors.size() - kept);
+      }
+      for (size_t i = 0; i < kept; ++i) {
+        report_->errors.push_back(std::move(errors[i]));
+        has_unpublished_errors_ = true;
       }
     }
 
+    // Only accessed by the workers, one task at a time.
     Reporter* absl_nonnull reporter_;
-    const StderrProcessor* absl_nonnull stderr_processor_;
+    const StreamMetrics* absl_nonnull metrics_;
+    Tracer* absl_nullable tracer_;
+    const uint64_t stream_id_;
+    const StreamLimits* absl_nonnull limits_;
+    BuildEventDecoder decoder_;
+    StderrProcessor::Stream stderr_stream_;
     std::optional<std::filesystem::path> testdata_;
-    std::vector<std::string> labels_ = {};
-    gimli::Recording recording_ = {};
+    std::string invocation_id_;
+    std::optional<RecordingFile> recording_;
     std::optional<Report> report_;
+    absl::Time last_publish_time_ = absl::InfinitePast();
+    bool has_unpublished_errors_ = false;
+    size_t retained_bytes_ = 0;
+
+    // Shared by the reactor and the workers.
+    std::mutex mutex_;
+    int pending_ = 0;
+    size_t pending_bytes_ = 0;
+    absl::AnyInvocable<void() &&> delayed_read_;
+  };
 
+  // Reads and acknowledgements are pipelined: the next request is read while
+  // the acknowledgements of the previous ones are written, back-to-back, in
+  // the order of the requests. Reading pauses while too many are waiting.
+  class Reactor final
+    : public grpc::ServerBidiReactor<PublishBuildToolEventStreamRequest,
+                                     PublishBuildToolEventStreamResponse> {
+   public:
+    Reactor(const StreamMetrics* absl_nonnull metrics,
+            std::atomic<int>* absl_nonnull active_streams,
+            Tracer* absl_nullable tracer, uint64_t stream_id,
+            std::shared_ptr<StreamState> state,
+            std::shared_ptr<WorkerPool::Sequence> sequence)
+      : metrics_(metrics),
+        active_streams_(active_streams),
+        tracer_(tracer),
+        stream_id_(stream_id),
+        state_(std::move(state)),
+        sequence_(std::move(sequence)) {
+      metrics_->active_streams->Add(1);
+      if (tracer_ != nullptr) start_ = Tracer::Clock::now();
+      StartNextRead();
+    }
+
+    void OnReadDone(bool ok) final {
+      std::scoped_lock lock(mutex_);
+      if (tracer_ != nullptr) {
+        tracer_->AddAsyncSpan("read", read_start_, Tracer::Clock::now(),
+                              stream_id_);
+      }
+      if (!ok) {
+        done_reading_ = true;
+        MaybeFinish();
+        return;
+      }
+      // The protocol (not very well documented) seems to be that the service
+      // must respond with the "identifiers" (stream id and sequence numnber)
+      // of the request, so the caller knows they have been acknowledged.
+      const auto& ordered_build_event = request_.ordered_build_event();
+      if (write_failed_) {
+        // The call is broken, so nothing is acknowledged nor read anymore.
+        done_reading_ = true;
+      } else {
+        auto& ack = *acks_.emplace_back(NewAck());
+        *ack.mutable_stream_id() = ordered_build_event.stream_id();
+        ack.set_sequence_number(ordered_build_event.sequence_number());
+        AccountAcks();
+        // Nothing is read after the last event, and the call is finished once
+        // all acknowledgements are written.
+        done_reading_ =
+          ordered_build_event.event().has_component_stream_finished();
+      }
+      // The request is processed by the workers, in the order of the stream.
+      const size_t bytes = request_.ByteSizeLong();
+      state_->AddPending(bytes);
+      sequence_->Post([state = state_, request = std::move(request_), bytes]() {
+        state->Process(request, bytes);
+      });
+      MaybeWrite();
+      MaybeFinish();
+      if (done_reading_) return;
+      // Reading resumes once an acknowledgement is written.
+      if (acks_.size() >= kMaxPendingAcks) {
+        read_paused_ = true;
+        return;
+      }
+      ReadWhenReady();
+    }
+
+    void OnWriteDone(bool ok) final {
+      std::scoped_lock lock(mutex_);
+      const auto now = std::chrono::steady_clock::now();
+      metrics_->ack_write->Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - write_start_)
+          .count());
+      if (tracer_ != nullptr) {
+        tracer_->AddAsyncSpan("ack", write_start_, now, stream_id_);
+      }
+      writing_ = false;
+      free_acks_.push_back(acks_.front());
+      acks_.pop_front();
+      if (!ok) {
+        // The call is broken, so the pending reads fail too, and finish it.
+        // A paused read is never started.
+        write_failed_ = true;
+        free_acks_.insert(free_acks_.end(), acks_.begin(), acks_.end());
+        acks_.clear();
+        if (read_paused_) done_reading_ = true;
+        read_paused_ = false;
+      }
+      if (read_paused_ && acks_.size() < kMaxPendingAcks) {
+        read_paused_ = false;
+        ReadWhenReady();
+      }
+      MaybeWrite();
+      MaybeFinish();
+    }
+
+    void OnDone() final {
+      metrics_->active_streams->Add(-1);
+      metrics_->inflight_bytes->Add(-static_cast<int64_t>(acks_bytes_));
+      active_streams_->fetch_sub(1, std::memory_order_relaxed);
+      if (tracer_ != nullptr) {
+        tracer_->AddAsyncSpan("stream", start_, Tracer::Clock::now(),
+                              stream_id_);
+      }
+      // The last requests may not be processed yet, so the stream is finished
+      // by the workers too, after them.
+      sequence_->Post([state = std::move(state_)]() { state->Finish(); });
+      delete this;
+    }
+
+   private:
+    // Reads the next request.
+    void StartNextRead() {
+      if (tracer_ != nullptr) read_start_ = Tracer::Clock::now();
+      StartRead(&request_);
+    }
+
+    // Starts the next read, unless the workers fell behind. It's then started
+    // by a worker, which is safe as the reactor can't be done before
+    // `done_reading_` is set, by the completion of that read.
+    void ReadWhenReady() {
+      state_->ReadWhenReady([this]() { StartNextRead(); });
+    }
+
+    // Returns an acknowledgement to fill, reusing a written one if any, so
+    // at most `kMaxPendingAcks` are ever allocated. Must be called with
+    // `mutex_` held.
+    PublishBuildToolEventStreamResponse* absl_nonnull NewAck() {
+      if (free_acks_.empty()) {
+        return google::protobuf::Arena::Create<
+          PublishBuildToolEventStreamResponse>(&acks_arena_);
+      }
+      auto* ack = free_acks_.back();
+      free_acks_.pop_back();
+      return ack;
+    }
+
+    // Accounts the memory of the acknowledgements in the inflight bytes. Must
+    // be called with `mutex_` held.
+    void AccountAcks() {
+      const auto bytes = static_cast<int64_t>(acks_arena_.SpaceAllocated());
+      metrics_->inflight_bytes->Add(bytes - acks_bytes_);
+      acks_bytes_ = bytes;
+    }
+
+    // Writes the next acknowledgement, unless one is being written. Must be
+    // called with `mutex_` held.
+    void MaybeWrite() {
+      if (writing_ || write_failed_ || acks_.empty()) return;
+      writing_ = true;
+      write_start_ = std::chrono::steady_clock::now();
+      StartWrite(acks_.front());
+    }
+
+    // Finishes once reading is done and every acknowledgement is written.
+    // Must be called with `mutex_` held.
+    void MaybeFinish() {
+      if (!done_reading_ || writing_ || !acks_.empty()) return;
+      Finish(write_failed_ ? grpc::Status::CANCELLED : grpc::Status::OK);
+    }
+
+    const StreamMetrics* absl_nonnull metrics_;
+    std::atomic<int>* absl_nonnull active_streams_;
+    Tracer* absl_nullable tracer_;
+    const uint64_t stream_id_;
+    // When the stream started, only if traced.
+    Tracer::Clock::time_point start_;
+    std::shared_ptr<StreamState> state_;
+    std::shared_ptr<WorkerPool::Sequence> sequence_;
+
+    // Only accessed by the ongoing read, which isn't concurrent with others.
+    // It's moved to the task processing it once read.
     PublishBuildToolEventStreamRequest request_;
-    PublishBuildToolEventStreamResponse response_;
+    // When the ongoing read started, only if traced.
+    Tracer::Clock::time_point read_start_;
+
+    std::mutex mutex_;
+    bool done_reading_ = false;
+    // Whether reading waits for acknowledgements to be written.
+    bool read_paused_ = false;
+    bool writing_ = false;
+    std::chrono::steady_clock::time_point write_start_;
+    bool write_failed_ = false;
+    // Acknowledgements are allocated on an arena, starting in a block of the
+    // reactor, and reused once written.
+    alignas(std::max_align_t) std::array<char, kAcksInitialBlockSize>
+      acks_initial_block_;
+    google::protobuf::Arena acks_arena_{acks_initial_block_.data(),
+                                        acks_initial_block_.size()};
+    std::deque<PublishBuildToolEventStreamResponse* absl_nonnull> acks_;
+    std::vector<PublishBuildToolEventStreamResponse* absl_nonnull> free_acks_;
+    // The memory of the acknowledgements accounted in the inflight bytes.
+    int64_t acks_bytes_ = 0;
   };
 
-  return new Reactor(reporter_, &stderr_processor_, testdata_);
+  if (auto status = Admit(); !status.ok()) {
+    return new RejectedReactor(std::move(status));
+  }
+  const uint64_t stream_id =
+    next_stream_id_.fetch_add(1, std::memory_order_relaxed);
+  return new Reactor(
+    &metrics_, &active_streams_, tracer_, stream_id,
+    std::make_shared<StreamState>(reporter_, &metrics_, tracer_, stream_id,
+                                  &limits_, &stderr_processor_, testdata_),
+    workers_.NewSequence());
 }
 
 }  // namespace gimli
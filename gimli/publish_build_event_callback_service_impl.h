@@ -1,22 +1,49 @@
 #ifndef _GIMLI_PUBLISH_BUILD_EVENT_CALLBACK_SERVICE_IMPL_H_
 #define _GIMLI_PUBLISH_BUILD_EVENT_CALLBACK_SERVICE_IMPL_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <optional>
+#include <vector>
 
 #include "absl/base/nullability.h"
+#include "gimli/metrics.h"
 #include "gimli/reporter.h"
 #include "gimli/stderr_processor.h"
+#include "gimli/tracer.h"
+#include "gimli/worker_pool.h"
 #include "google/devtools/build/v1/publish_build_event.grpc.pb.h"
 #include "google/devtools/build/v1/publish_build_event.pb.h"
 
 namespace gimli {
 
+// Limits on the resources taken by the build event streams, so excess load
+// is rejected rather than slowing every stream down. Zero means no limit.
+struct StreamLimits {
+  // Streams processed at once, beyond which new ones are rejected.
+  int max_streams = 0;
+  // Bytes of the requests of a stream waiting for the workers, beyond which
+  // the stream is no longer read until they catch up.
+  size_t max_stream_bytes = 0;
+  // Errors kept in the report of a build, beyond which they are dropped.
+  size_t max_errors_per_report = 0;
+  // Bytes of the requests of all streams waiting for the workers, and of the
+  // state the streams keep, beyond which new streams are rejected.
+  size_t max_inflight_bytes = 0;
+};
+
 class PublishBuildEventCallbackServiceImpl final
   : public google::devtools::build::v1::PublishBuildEvent::CallbackService {
  public:
-  // Reporter's scope must encompass the scope of this object.
+  // Reporter's, metrics' and tracer's scopes must encompass the scope of
+  // this object. Streams are traced if `tracer` is not null. Events are
+  // processed by `num_workers` threads, off the gRPC callback threads.
+  // Streams exceeding `limits` fail with RESOURCE_EXHAUSTED.
   PublishBuildEventCallbackServiceImpl(
-    Reporter& reporter, std::optional<std::filesystem::path> testdata);
+    Reporter& reporter, Metrics& metrics, Tracer* absl_nullable tracer,
+    std::optional<std::filesystem::path> testdata, int num_workers,
+    StreamLimits limits = {});
 
   grpc::ServerUnaryReactor* absl_nonnull PublishLifecycleEvent(
     grpc::CallbackServerContext* absl_nonnull context,
@@ -32,9 +59,43 @@ class PublishBuildEventCallbackServiceImpl final
     grpc::CallbackServerContext* absl_nonnull context) final;
 
  private:
+  // The metrics of the streams, registered once for all of them.
+  struct StreamMetrics {
+    // Events by payload, indexed by the payload field number.
+    std::vector<Counter*> events;
+    Counter* absl_nonnull other_events;
+    Counter* absl_nonnull stderr_bytes;
+    Histogram* absl_nonnull any_unpack;
+    Histogram* absl_nonnull stderr_to_errors;
+    Histogram* absl_nonnull ack_write;
+    Gauge* absl_nonnull active_streams;
+    // Serialized bytes of the requests waiting for the workers, and memory of
+    // the acknowledgements and of the stderr kept by the streams.
+    Gauge* absl_nonnull inflight_bytes;
+    Counter* absl_nonnull rejected_for_streams;
+    Counter* absl_nonnull rejected_for_memory;
+    Counter* absl_nonnull dropped_errors;
+
+    void CountEvent(int payload_case) const;
+  };
+
+  static StreamMetrics RegisterMetrics(Metrics& metrics);
+
+  // Counts a new stream if `limits_` allow it, otherwise returns why not.
+  grpc::Status Admit();
+
   Reporter* absl_nonnull reporter_;
+  const StreamMetrics metrics_;
+  Tracer* absl_nullable tracer_;
+  const StreamLimits limits_;
+  // Streams admitted and not done yet.
+  std::atomic<int> active_streams_ = 0;
+  // Identifies the streams in the trace.
+  std::atomic<uint64_t> next_stream_id_ = 0;
   StderrProcessor stderr_processor_;
   std::optional<std::filesystem::path> testdata_;
+  // Last, so the pending events are processed before the rest is destroyed.
+  WorkerPool workers_;
 };
 
 }  // namespace gimli
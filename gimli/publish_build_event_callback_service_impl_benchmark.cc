@@ -0,0 +1,102 @@
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gimli/benchmark_testdata.h"
+#include "gimli/grpc_test_server.h"
+#include "gimli/metrics.h"
+#include "gimli/publish_build_event_callback_service_impl.h"
+#include "gimli/reporter.h"
+#include "google/devtools/build/v1/publish_build_event.grpc.pb.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/arena.h"
+#include "grpcpp/grpcpp.h"
+
+namespace gimli {
+namespace {
+using ::google::devtools::build::v1::PublishBuildEvent;
+using ::google::devtools::build::v1::PublishBuildToolEventStreamRequest;
+using ::google::devtools::build::v1::PublishBuildToolEventStreamResponse;
+
+// Measures the parsing of the recorded requests, by concurrent threads like
+// concurrent streams, on the heap like the service does, or on an arena.
+template <bool kOnArena>
+void BM_ParseRequests(benchmark::State& state) {
+  std::vector<std::string> serialized;
+  for (const auto& request : BenchmarkTestdata::Requests(1)) {
+    serialized.push_back(request.SerializeAsString());
+  }
+  for (auto _ : state) {
+    google::protobuf::Arena arena;
+    for (const auto& bytes : serialized) {
+      auto* request =
+        kOnArena
+          ? google::protobuf::Arena::Create<PublishBuildToolEventStreamRequest>(
+              &arena)
+          : new PublishBuildToolEventStreamRequest();
+      benchmark::DoNotOptimize(request->ParseFromString(bytes));
+      if (!kOnArena) delete request;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * serialized.size());
+}
+BENCHMARK(BM_ParseRequests<false>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_ParseRequests<true>)->ThreadRange(1, 16)->UseRealTime();
+
+struct Server {
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl service{
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/4};
+  TestServer test_server =
+    TestServer::Builder().RegisterService(&service).BuildAndStart();
+};
+
+// The server is shared by all the threads of a benchmark, which are its
+// clients, and by all its runs. It is never destroyed.
+Server& GetServer() {
+  static auto* const server = new Server();
+  return *server;
+}
+
+// Measures the throughput of streams replaying the recorded build, with
+// `copies` times more events. Like Bazel, the client writes the requests
+// while it reads the acknowledgements.
+void BM_PublishBuildToolEventStream(benchmark::State& state) {
+  auto stub = GetServer().test_server.NewStub<PublishBuildEvent>();
+  const std::vector<PublishBuildToolEventStreamRequest> requests =
+    BenchmarkTestdata::Requests(state.range(0));
+
+  for (auto _ : state) {
+    grpc::ClientContext context;
+    auto stream = stub->PublishBuildToolEventStream(&context);
+    std::thread writer([&]() {
+      for (const auto& request : requests) {
+        if (!stream->Write(request)) break;
+      }
+      stream->WritesDone();
+    });
+    size_t acknowledged = 0;
+    PublishBuildToolEventStreamResponse response;
+    while (stream->Read(&response)) ++acknowledged;
+    writer.join();
+    if (auto status = stream->Finish(); !status.ok()) {
+      state.SkipWithError(status.error_message().c_str());
+    }
+    if (acknowledged != requests.size()) {
+      state.SkipWithError("Some requests were not acknowledged");
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * requests.size());
+}
+BENCHMARK(BM_PublishBuildToolEventStream)
+  ->Arg(1)
+  ->Arg(100)
+  ->ThreadRange(1, 16)
+  ->UseRealTime();
+
+}  // namespace
+}  // namespace gimli
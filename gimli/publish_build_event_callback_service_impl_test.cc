@@ -1,26 +1,58 @@
 #include "gimli/publish_build_event_callback_service_impl.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <thread>
 
+#include "absl/base/nullability.h"
 #include "absl/status/status_matchers.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
 #include "gimli/grpc_test_server.h"
 #include "gimli/gtest_runfiles.h"
+#include "gimli/metrics.h"
 #include "gimli/recording.pb.h"
+#include "gimli/report.h"
+#include "gimli/reporter.h"
 #include "gmock/gmock.h"
 #include "google/devtools/build/v1/publish_build_event.pb.h"
 #include "google/protobuf/text_format.h"
 #include "grpcpp/grpcpp.h"
 #include "gtest/gtest.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
 
 namespace gimli {
 namespace {
 using ::absl_testing::IsOk;
+using ::build_event_stream::BuildEvent;
 using ::google::devtools::build::v1::PublishBuildEvent;
+using ::google::devtools::build::v1::PublishBuildToolEventStreamRequest;
 using ::google::devtools::build::v1::PublishBuildToolEventStreamResponse;
 using ::testing::ElementsAreArray;
+using ::testing::HasSubstr;
 using ::testing::SizeIs;
 
+// Returns the request carrying `event`, or finishing the stream if null.
+PublishBuildToolEventStreamRequest MakeRequest(
+  int64_t sequence_number, const BuildEvent* absl_nullable event) {
+  PublishBuildToolEventStreamRequest request;
+  auto& ordered_build_event = *request.mutable_ordered_build_event();
+  ordered_build_event.mutable_stream_id()->set_invocation_id("invocation");
+  ordered_build_event.set_sequence_number(sequence_number);
+  if (event == nullptr) {
+    ordered_build_event.mutable_event()->mutable_component_stream_finished();
+  } else {
+    ordered_build_event.mutable_event()->mutable_bazel_event()->PackFrom(
+      *event);
+  }
+  return request;
+}
+
 TEST(PublishBuildEventCallbackServiceImplTest, Works) {
   // Read the recording from testdata.
   auto data = Runfiles::ContentsOf("gimli/testdata/non_fatal_error.textproto");
@@ -31,7 +63,14 @@ TEST(PublishBuildEventCallbackServiceImplTest, Works) {
   // Create a server with the service to be tested. This selects a random port
   // automatically, which we save for connecting to it later.
   Reporter reporter;
-  PublishBuildEventCallbackServiceImpl under_test(reporter, std::nullopt);
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2);
+  // Events are processed asynchronously, so wait for the finished report.
+  absl::Notification finished;
+  auto subscription = reporter.Subscribe([&](const Report& report) {
+    if (report.status == Report::Status::kFinished) finished.Notify();
+  });
 
   auto test_server =
     TestServer::Builder().RegisterService(&under_test).BuildAndStart();
@@ -62,11 +101,13 @@ TEST(PublishBuildEventCallbackServiceImplTest, Works) {
   stream->Finish();
 
   std::move(test_server).Shutdown();
+  ASSERT_TRUE(finished.WaitForNotificationWithTimeout(absl::Seconds(10)));
 
   // Check that the reporter has a report
   auto report = reporter.GetReportFor("/Users/xdecoret/gimli");
-  ASSERT_TRUE(report.has_value());
+  ASSERT_NE(report, nullptr);
   ASSERT_EQ(report->workspace_path, "/Users/xdecoret/gimli");
+  ASSERT_EQ(report->status, Report::Status::kFinished);
 
   // The report time is known from the testdata: grep for `start_time`,
   // ignore the deprecated `start_time_millis`.
@@ -84,6 +125,336 @@ TEST(PublishBuildEventCallbackServiceImplTest, Works) {
                 R"(    6 |   std::cout << y << std::endl;)",
                 R"(      |                ^)",
               }));
+
+  // Every event and acknowledgement is measured.
+  const auto text = Metrics::ToPrometheusText(metrics.Collect());
+  EXPECT_THAT(text, HasSubstr(R"(gimli_events_total{payload="started"} 1)"));
+  EXPECT_THAT(text, HasSubstr(absl::StrCat("gimli_ack_write_seconds_count ",
+                                           recording.requests_size())));
+  EXPECT_THAT(text, HasSubstr("gimli_active_streams 0"));
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, RejectsStreamsBeyondLimit) {
+  auto data = Runfiles::ContentsOf("gimli/testdata/non_fatal_error.textproto");
+  ASSERT_THAT(data, IsOk());
+  gimli::Recording recording;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(*data, &recording));
+  ASSERT_GT(recording.requests_size(), 1);
+
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2,
+    {.max_streams = 1});
+  absl::Notification finished;
+  auto subscription = reporter.Subscribe([&](const Report& report) {
+    if (report.status == Report::Status::kFinished) finished.Notify();
+  });
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  // Once its first request is acknowledged, the first stream is admitted.
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  PublishBuildToolEventStreamResponse response;
+  ASSERT_TRUE(stream->Write(recording.requests(0)));
+  ASSERT_TRUE(stream->Read(&response));
+
+  // So the second one is rejected, without being read.
+  grpc::ClientContext rejected_context;
+  auto rejected = stub->PublishBuildToolEventStream(&rejected_context);
+  EXPECT_FALSE(rejected->Read(&response));
+  EXPECT_EQ(rejected->Finish().error_code(),
+            grpc::StatusCode::RESOURCE_EXHAUSTED);
+
+  // While the first one completes.
+  for (int i = 1; i < recording.requests_size(); ++i) {
+    EXPECT_TRUE(stream->Write(recording.requests(i)));
+  }
+  stream->WritesDone();
+  int responses_count = 1;
+  while (stream->Read(&response)) ++responses_count;
+  EXPECT_EQ(responses_count, recording.requests_size());
+  EXPECT_TRUE(stream->Finish().ok());
+
+  std::move(test_server).Shutdown();
+  ASSERT_TRUE(finished.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  const auto text = Metrics::ToPrometheusText(metrics.Collect());
+  EXPECT_THAT(text,
+              HasSubstr(R"(gimli_rejected_streams_total{reason="streams"} 1)"));
+  EXPECT_THAT(text, HasSubstr("gimli_inflight_bytes 0"));
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, RejectsStreamsBeyondMemory) {
+  auto data = Runfiles::ContentsOf("gimli/testdata/non_fatal_error.textproto");
+  ASSERT_THAT(data, IsOk());
+  gimli::Recording recording;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(*data, &recording));
+  ASSERT_GT(recording.requests_size(), 1);
+
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2,
+    {.max_inflight_bytes = 1});
+  absl::Notification finished;
+  auto subscription = reporter.Subscribe([&](const Report& report) {
+    if (report.status == Report::Status::kFinished) finished.Notify();
+  });
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  // Once its first request is acknowledged, the first stream keeps the
+  // memory of its acknowledgements, which is over the limit.
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  PublishBuildToolEventStreamResponse response;
+  ASSERT_TRUE(stream->Write(recording.requests(0)));
+  ASSERT_TRUE(stream->Read(&response));
+
+  // So the second one is rejected, without being read.
+  grpc::ClientContext rejected_context;
+  auto rejected = stub->PublishBuildToolEventStream(&rejected_context);
+  EXPECT_FALSE(rejected->Read(&response));
+  EXPECT_EQ(rejected->Finish().error_code(),
+            grpc::StatusCode::RESOURCE_EXHAUSTED);
+
+  // While the first one completes, and then releases all its memory.
+  for (int i = 1; i < recording.requests_size(); ++i) {
+    EXPECT_TRUE(stream->Write(recording.requests(i)));
+  }
+  stream->WritesDone();
+  while (stream->Read(&response)) continue;
+  EXPECT_TRUE(stream->Finish().ok());
+  ASSERT_TRUE(finished.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  const auto text = Metrics::ToPrometheusText(metrics.Collect());
+  EXPECT_THAT(text,
+              HasSubstr(R"(gimli_rejected_streams_total{reason="memory"} 1)"));
+  EXPECT_THAT(text, HasSubstr("gimli_inflight_bytes 0"));
+
+  // So new streams are admitted again.
+  grpc::ClientContext admitted_context;
+  auto admitted = stub->PublishBuildToolEventStream(&admitted_context);
+  EXPECT_TRUE(admitted->Write(MakeRequest(1, nullptr)));
+  EXPECT_TRUE(admitted->Read(&response));
+  admitted->WritesDone();
+  EXPECT_TRUE(admitted->Finish().ok());
+  std::move(test_server).Shutdown();
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, CompletesStreamBeyondBytes) {
+  auto data = Runfiles::ContentsOf("gimli/testdata/non_fatal_error.textproto");
+  ASSERT_THAT(data, IsOk());
+  gimli::Recording recording;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(*data, &recording));
+
+  // Every request is over the limit, so the stream is only read once the
+  // workers processed the previous request.
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2,
+    {.max_stream_bytes = 1});
+  absl::Notification finished;
+  auto subscription = reporter.Subscribe([&](const Report& report) {
+    if (report.status == Report::Status::kFinished) finished.Notify();
+  });
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  for (const auto& request : recording.requests()) {
+    EXPECT_TRUE(stream->Write(request));
+  }
+  stream->WritesDone();
+  int responses_count = 0;
+  PublishBuildToolEventStreamResponse response;
+  while (stream->Read(&response)) ++responses_count;
+  EXPECT_EQ(responses_count, recording.requests_size());
+  EXPECT_TRUE(stream->Finish().ok());
+
+  std::move(test_server).Shutdown();
+  ASSERT_TRUE(finished.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  const auto report = reporter.GetReportFor("/Users/xdecoret/gimli");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->errors, SizeIs(1));
+  EXPECT_THAT(Metrics::ToPrometheusText(metrics.Collect()),
+              HasSubstr("gimli_inflight_bytes 0"));
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, DropsErrorsBeyondLimit) {
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2,
+    {.max_errors_per_report = 2});
+  absl::Notification finished;
+  auto subscription = reporter.Subscribe([&](const Report& report) {
+    if (report.status == Report::Status::kFinished) finished.Notify();
+  });
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  BuildEvent started;
+  started.mutable_started()->set_workspace_directory("/workspace");
+  BuildEvent progress;
+  progress.mutable_progress()->set_stderr(
+    "a.cc:1:1: error: one\n"
+    "a.cc:2:1: error: two\n"
+    "a.cc:3:1: error: three\n");
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  EXPECT_TRUE(stream->Write(MakeRequest(1, &started)));
+  EXPECT_TRUE(stream->Write(MakeRequest(2, &progress)));
+  EXPECT_TRUE(stream->Write(MakeRequest(3, nullptr)));
+  stream->WritesDone();
+  PublishBuildToolEventStreamResponse response;
+  while (stream->Read(&response)) continue;
+  EXPECT_TRUE(stream->Finish().ok());
+
+  std::move(test_server).Shutdown();
+  ASSERT_TRUE(finished.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  const auto report = reporter.GetReportFor("/workspace");
+  ASSERT_NE(report, nullptr);
+  ASSERT_THAT(report->errors, SizeIs(2));
+  EXPECT_EQ(report->errors[0].message, "error: one");
+  EXPECT_EQ(report->errors[1].message, "error: two");
+  EXPECT_THAT(Metrics::ToPrometheusText(metrics.Collect()),
+              HasSubstr("gimli_dropped_errors_total 1"));
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, FinishesCancelledStreams) {
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2,
+    {.max_streams = 1});
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  // The acknowledgements are large and never read, so they fill the flow
+  // control window while the next request is being read.
+  const std::string invocation_id(4000, 'i');
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  PublishBuildToolEventStreamRequest request;
+  auto& ordered_build_event = *request.mutable_ordered_build_event();
+  ordered_build_event.mutable_stream_id()->set_invocation_id(invocation_id);
+  for (int i = 1; i <= 40; ++i) {
+    ordered_build_event.set_sequence_number(i);
+    ASSERT_TRUE(stream->Write(request));
+  }
+  absl::SleepFor(absl::Milliseconds(100));
+  context.TryCancel();
+  stream->Finish();
+
+  // Once done, the stream frees its slot, so another one is admitted.
+  const auto deadline = absl::Now() + absl::Seconds(10);
+  while (!absl::StrContains(Metrics::ToPrometheusText(metrics.Collect()),
+                            "gimli_active_streams 0") &&
+         absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  grpc::ClientContext admitted_context;
+  auto admitted = stub->PublishBuildToolEventStream(&admitted_context);
+  PublishBuildToolEventStreamResponse response;
+  EXPECT_TRUE(admitted->Write(MakeRequest(1, nullptr)));
+  EXPECT_TRUE(admitted->Read(&response));
+  admitted->WritesDone();
+  EXPECT_TRUE(admitted->Finish().ok());
+  std::move(test_server).Shutdown();
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, AcknowledgesAllInOrder) {
+  Reporter reporter;
+  Metrics metrics;
+  PublishBuildEventCallbackServiceImpl under_test(
+    reporter, metrics, /*tracer=*/nullptr, std::nullopt, /*num_workers=*/2);
+  auto test_server =
+    TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+  auto stub = test_server.NewStub<PublishBuildEvent>();
+
+  // The client only starts reading the acknowledgements late, and they are
+  // large, so they fill the flow control window: reading is then paused,
+  // and resumed as they are read.
+  constexpr int kRequests = 2000;
+  const std::string invocation_id(1000, 'i');
+  grpc::ClientContext context;
+  auto stream = stub->PublishBuildToolEventStream(&context);
+  std::thread writer([&]() {
+    PublishBuildToolEventStreamRequest request;
+    auto& ordered_build_event = *request.mutable_ordered_build_event();
+    ordered_build_event.mutable_stream_id()->set_invocation_id(invocation_id);
+    for (int i = 1; i <= kRequests; ++i) {
+      ordered_build_event.set_sequence_number(i);
+      if (i == kRequests) {
+        ordered_build_event.mutable_event()
+          ->mutable_component_stream_finished();
+      }
+      if (!stream->Write(request)) break;
+    }
+    stream->WritesDone();
+  });
+  absl::SleepFor(absl::Milliseconds(100));
+
+  int64_t expected = 1;
+  PublishBuildToolEventStreamResponse response;
+  while (stream->Read(&response)) {
+    EXPECT_EQ(response.sequence_number(), expected);
+    EXPECT_EQ(response.stream_id().invocation_id(), invocation_id);
+    ++expected;
+  }
+  writer.join();
+  EXPECT_EQ(expected, kRequests + 1);
+  EXPECT_TRUE(stream->Finish().ok());
+}
+
+TEST(PublishBuildEventCallbackServiceImplTest, RecordsOnlyValidInvocationIds) {
+  const auto testdata =
+    std::filesystem::path(testing::TempDir()) / "recordings";
+  std::filesystem::remove_all(testdata);
+  std::filesystem::create_directories(testdata);
+  const auto escaped = testdata.parent_path() / "escaped.binpb";
+  std::filesystem::remove(escaped);
+
+  Reporter reporter;
+  Metrics metrics;
+  {
+    // The workers finish the streams before the service is destroyed.
+    PublishBuildEventCallbackServiceImpl under_test(
+      reporter, metrics, /*tracer=*/nullptr, testdata, /*num_workers=*/2);
+    auto test_server =
+      TestServer::Builder().RegisterService(&under_test).BuildAndStart();
+    auto stub = test_server.NewStub<PublishBuildEvent>();
+    for (const std::string invocation_id :
+         {"valid-id_0", "../escaped", "", "a/b"}) {
+      PublishBuildToolEventStreamRequest request;
+      auto& ordered_build_event = *request.mutable_ordered_build_event();
+      ordered_build_event.mutable_stream_id()->set_invocation_id(invocation_id);
+      ordered_build_event.set_sequence_number(1);
+      ordered_build_event.mutable_event()->mutable_component_stream_finished();
+      grpc::ClientContext context;
+      auto stream = stub->PublishBuildToolEventStream(&context);
+      EXPECT_TRUE(stream->Write(request));
+      stream->WritesDone();
+      PublishBuildToolEventStreamResponse response;
+      while (stream->Read(&response)) continue;
+      EXPECT_TRUE(stream->Finish().ok()) << invocation_id;
+    }
+    std::move(test_server).Shutdown();
+  }
+
+  EXPECT_TRUE(std::filesystem::exists(testdata / "valid-id_0.binpb"));
+  EXPECT_FALSE(std::filesystem::exists(escaped));
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(testdata),
+                          std::filesystem::directory_iterator()),
+            1);
 }
 
 }  // namespace
@@ -0,0 +1,106 @@
+#include "gimli/recording_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "gimli/recording.pb.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/message_lite.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+namespace {
+using ::google::devtools::build::v1::PublishBuildToolEventStreamRequest;
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::internal::WireFormatLite;
+
+// A tag and a length are varints of at most 5 bytes each.
+constexpr size_t kMaxRecordHeaderSize = 10;
+
+}  // namespace
+
+absl::StatusOr<RecordingFile> RecordingFile::Create(
+  std::filesystem::path path) {
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream.is_open()) {
+    return absl::InternalError(absl::StrCat("Cannot create ", path.string()));
+  }
+  return RecordingFile(std::move(path), std::move(stream));
+}
+
+absl::StatusOr<Recording> RecordingFile::Read(std::filesystem::path path) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream.is_open()) {
+    return absl::NotFoundError(absl::StrCat("Cannot open ", path.string()));
+  }
+  const std::string data((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+
+  Recording recording;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(data.data()),
+                         static_cast<int>(data.size()));
+  while (const uint32_t tag = input.ReadTag()) {
+    const int number = WireFormatLite::GetTagFieldNumber(tag);
+    bool complete = false;
+    if (number == Recording::kRequestsFieldNumber) {
+      complete = WireFormatLite::ReadMessage(&input, recording.add_requests());
+      if (!complete) recording.mutable_requests()->RemoveLast();
+    } else if (number == Recording::kBuildEventsFieldNumber) {
+      complete =
+        WireFormatLite::ReadMessage(&input, recording.add_build_events());
+      if (!complete) recording.mutable_build_events()->RemoveLast();
+    } else {
+      complete = WireFormatLite::SkipField(&input, tag);
+    }
+    if (!complete) {
+      LOG(WARNING) << "Ignoring the incomplete last record of " << path;
+      break;
+    }
+  }
+  return recording;
+}
+
+void RecordingFile::Append(const PublishBuildToolEventStreamRequest& request) {
+  Append(Recording::kRequestsFieldNumber, request);
+}
+
+void RecordingFile::Append(const build_event_stream::BuildEvent& build_event) {
+  Append(Recording::kBuildEventsFieldNumber, build_event);
+}
+
+void RecordingFile::Append(int field_number,
+                           const google::protobuf::MessageLite& message) {
+  const size_t size = message.ByteSizeLong();
+  buffer_.resize(kMaxRecordHeaderSize + size);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  auto* const begin = reinterpret_cast<uint8_t*>(buffer_.data());
+  uint8_t* end = CodedOutputStream::WriteTagToArray(
+    WireFormatLite::MakeTag(field_number,
+                            WireFormatLite::WIRETYPE_LENGTH_DELIMITED),
+    begin);
+  end =
+    CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(size), end);
+  end = message.SerializeWithCachedSizesToArray(end);
+  stream_.write(buffer_.data(), end - begin);
+}
+
+absl::Status RecordingFile::Close() {
+  stream_.close();
+  if (stream_.fail()) {
+    return absl::InternalError(absl::StrCat("Cannot write ", path_.string()));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace gimli
@@ -0,0 +1,57 @@
+#ifndef GIMLI_RECORDING_FILE_H_
+#define GIMLI_RECORDING_FILE_H_
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gimli/recording.pb.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/message_lite.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+
+// A `Recording` written to disk as it's recorded, one length-delimited record
+// per request or build event. Records are the fields of `Recording` in its
+// wire format, so a complete file parses as one. A file truncated by a crash
+// can still be read, up to its last complete record.
+class RecordingFile {
+ public:
+  // Creates the file at `path`, or truncates it.
+  static absl::StatusOr<RecordingFile> Create(std::filesystem::path path);
+
+  // Reads the file at `path`, ignoring an incomplete last record.
+  static absl::StatusOr<Recording> Read(std::filesystem::path path);
+
+  RecordingFile(RecordingFile&&) = default;
+  RecordingFile& operator=(RecordingFile&&) = default;
+
+  void Append(
+    const google::devtools::build::v1::PublishBuildToolEventStreamRequest&
+      request);
+  void Append(const build_event_stream::BuildEvent& build_event);
+
+  // Flushes the records to disk, and returns whether they were all written.
+  absl::Status Close();
+
+  const std::filesystem::path& path() const { return path_; }
+
+ private:
+  RecordingFile(std::filesystem::path path, std::ofstream stream)
+    : path_(std::move(path)), stream_(std::move(stream)) {}
+
+  void Append(int field_number, const google::protobuf::MessageLite& message);
+
+  std::filesystem::path path_;
+  std::ofstream stream_;
+  // Reused across records, to serialize them before writing.
+  std::string buffer_;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_RECORDING_FILE_H_
@@ -0,0 +1,94 @@
+#include "gimli/recording_file.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "absl/status/status_matchers.h"
+#include "gimli/recording.pb.h"
+#include "gmock/gmock.h"
+#include "google/devtools/build/v1/publish_build_event.pb.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "protobuf-matchers/protocol-buffer-matchers.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace gimli {
+namespace {
+using ::absl_testing::IsOk;
+using ::protobuf_matchers::EqualsProto;
+
+Recording MakeRecording() {
+  Recording recording;
+  EXPECT_TRUE(google::protobuf::TextFormat::ParseFromString(
+    R"pb(
+      requests {
+        ordered_build_event {
+          stream_id { build_id: "build" invocation_id: "invocation" }
+          sequence_number: 1
+        }
+      }
+      requests {
+        ordered_build_event {
+          stream_id { build_id: "build" invocation_id: "invocation" }
+          sequence_number: 2
+        }
+      }
+      build_events { progress { stderr: "some error" } }
+    )pb",
+    &recording));
+  return recording;
+}
+
+void Write(const std::filesystem::path& path, const Recording& recording) {
+  auto file = RecordingFile::Create(path);
+  ASSERT_THAT(file, IsOk());
+  for (const auto& request : recording.requests()) file->Append(request);
+  for (const auto& build_event : recording.build_events()) {
+    file->Append(build_event);
+  }
+  ASSERT_THAT(file->Close(), IsOk());
+}
+
+TEST(RecordingFileTest, Works) {
+  const auto path =
+    std::filesystem::path(testing::TempDir()) / "works.binpb";
+  const Recording recording = MakeRecording();
+  Write(path, recording);
+
+  auto read = RecordingFile::Read(path);
+  ASSERT_THAT(read, IsOk());
+  EXPECT_THAT(*read, EqualsProto(recording));
+}
+
+TEST(RecordingFileTest, IsRecordingInWireFormat) {
+  const auto path =
+    std::filesystem::path(testing::TempDir()) / "wire_format.binpb";
+  const Recording recording = MakeRecording();
+  Write(path, recording);
+
+  std::ifstream stream(path, std::ios::binary);
+  Recording parsed;
+  ASSERT_TRUE(parsed.ParseFromIstream(&stream));
+  EXPECT_THAT(parsed, EqualsProto(recording));
+}
+
+TEST(RecordingFileTest, IgnoresIncompleteLastRecord) {
+  const auto path =
+    std::filesystem::path(testing::TempDir()) / "truncated.binpb";
+  Recording recording = MakeRecording();
+  Write(path, recording);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+  auto read = RecordingFile::Read(path);
+  ASSERT_THAT(read, IsOk());
+  recording.clear_build_events();
+  EXPECT_THAT(*read, EqualsProto(recording));
+}
+
+TEST(RecordingFileTest, ReturnsErrorForMissingFile) {
+  EXPECT_FALSE(RecordingFile::Read("/does/not/exist.binpb").ok());
+}
+
+}  // namespace
+}  // namespace gimli
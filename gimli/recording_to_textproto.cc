@@ -0,0 +1,43 @@
+// Converts a recording written by `gimli_server --record` to text format,
+// for review or to update the recordings in `gimli/testdata`. For example:
+//
+//   bazel run //gimli:recording_to_textproto --
+//     $PWD/gimli/testdata/<invocation id>.binpb
+//     $PWD/gimli/testdata/non_fatal_error.textproto
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "gimli/recording_file.h"
+#include "google/protobuf/stubs/common.h"
+#include "google/protobuf/text_format.h"
+
+int main(int argc, char** argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <recording.binpb> <output.textproto>\n";
+    return 1;
+  }
+
+  auto recording = gimli::RecordingFile::Read(argv[1]);
+  if (!recording.ok()) {
+    std::cerr << recording.status() << "\n";
+    return 1;
+  }
+  std::string contents;
+  if (!google::protobuf::TextFormat::PrintToString(*recording, &contents)) {
+    std::cerr << "Cannot print the recording to text format\n";
+    return 1;
+  }
+  std::ofstream stream(argv[2], std::ios::trunc);
+  stream << contents;
+  if (!stream.good()) {
+    std::cerr << "Cannot write " << argv[2] << "\n";
+    return 1;
+  }
+
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
+}
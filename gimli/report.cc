@@ -0,0 +1,130 @@
+#include "gimli/report.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "absl/log/check.h"
+#include "absl/strings/match.h"
+
+namespace gimli {
+
+Report::ErrorList::ErrorList(std::initializer_list<Error> errors) {
+  reserve(errors.size());
+  for (const auto& error : errors) push_back(error);
+}
+
+std::vector<size_t> Report::ErrorList::IndicesInPath(
+  std::string_view path) const {
+  std::vector<size_t> indices;
+  const uint32_t found = Find(path);
+  if (found != kNoPath) AppendIndicesOf(paths_[found], indices);
+  return indices;
+}
+
+std::vector<size_t> Report::ErrorList::IndicesUnderPrefix(
+  std::string_view prefix) const {
+  std::vector<size_t> indices;
+  size_t paths_found = 0;
+  for (const auto& interned : paths_) {
+    if (absl::StartsWith(View(interned.name), prefix)) {
+      AppendIndicesOf(interned, indices);
+      ++paths_found;
+    }
+  }
+  // The errors of several paths are interleaved.
+  if (paths_found > 1) std::sort(indices.begin(), indices.end());
+  return indices;
+}
+
+void Report::ErrorList::push_back(const Error& error) {
+  const auto first_context = static_cast<uint32_t>(context_.size());
+  for (const auto& line : error.context) context_.push_back(Append(line));
+  const uint32_t path = Intern(error.path_in_workspace.native());
+  const auto index = static_cast<uint32_t>(errors_.size());
+  Path& interned = paths_[path];
+  if (interned.last_error == kNoError) {
+    interned.first_error = index;
+  } else {
+    errors_[interned.last_error].next_in_path = index;
+  }
+  interned.last_error = index;
+  errors_.push_back({
+    .path = path,
+    .line = error.line,
+    .column = error.column,
+    .message = Append(error.message),
+    .first_context = first_context,
+    .context_size = static_cast<uint32_t>(error.context.size()),
+  });
+}
+
+void Report::ErrorList::clear() {
+  buffer_.clear();
+  paths_.clear();
+  path_by_hash_.clear();
+  context_.clear();
+  errors_.clear();
+}
+
+size_t Report::ErrorList::HeapBytes() const {
+  // A short buffer is stored inline, in the string itself.
+  static const size_t kInlineCapacity = std::string().capacity();
+  const size_t buffer_bytes =
+    buffer_.capacity() > kInlineCapacity ? buffer_.capacity() + 1 : 0;
+  // A slot of the hash map also takes a byte of control.
+  return buffer_bytes + paths_.capacity() * sizeof(Path) +
+         path_by_hash_.capacity() *
+           (sizeof(decltype(path_by_hash_)::value_type) + 1) +
+         context_.capacity() * sizeof(Extent) +
+         errors_.capacity() * sizeof(CompactError);
+}
+
+Report::ErrorList::Extent Report::ErrorList::Append(std::string_view string) {
+  CHECK_LE(buffer_.size() + string.size(), std::numeric_limits<uint32_t>::max())
+    << "Errors over 4GiB";
+  const Extent extent{.offset = static_cast<uint32_t>(buffer_.size()),
+                      .size = static_cast<uint32_t>(string.size())};
+  buffer_.append(string);
+  return extent;
+}
+
+uint32_t Report::ErrorList::Find(std::string_view path) const {
+  const auto it = path_by_hash_.find(absl::Hash<std::string_view>()(path));
+  if (it == path_by_hash_.end()) return kNoPath;
+  if (View(paths_[it->second].name) == path) return it->second;
+  for (size_t i = 0; i < paths_.size(); ++i) {
+    if (View(paths_[i].name) == path) return static_cast<uint32_t>(i);
+  }
+  return kNoPath;
+}
+
+uint32_t Report::ErrorList::Intern(std::string_view path) {
+  // Errors come in bursts from the same file, so the latest path is tried
+  // before hashing.
+  if (!paths_.empty() && View(paths_.back().name) == path) {
+    return static_cast<uint32_t>(paths_.size() - 1);
+  }
+  const uint32_t found = Find(path);
+  if (found != kNoPath) return found;
+  const auto index = static_cast<uint32_t>(paths_.size());
+  paths_.push_back({.name = Append(path)});
+  path_by_hash_.try_emplace(absl::Hash<std::string_view>()(path), index);
+  return index;
+}
+
+void Report::ErrorList::AppendIndicesOf(const Path& path,
+                                        std::vector<size_t>& indices) const {
+  for (uint32_t i = path.first_error; i != kNoError;
+       i = errors_[i].next_in_path) {
+    indices.push_back(i);
+  }
+}
+
+}  // namespace gimli
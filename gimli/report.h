@@ -1,14 +1,56 @@
 #ifndef _GIMLI_REPORT_H_
 #define _GIMLI_REPORT_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/time/time.h"
 
 namespace gimli {
 
+// Iterates over a list whose `operator[]` returns its elements by value.
+template <typename List>
+class IndexIterator {
+ public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = typename List::value_type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = void;
+  using reference = value_type;
+
+  IndexIterator() = default;
+  IndexIterator(const List* list, size_t index) : list_(list), index_(index) {}
+
+  value_type operator*() const { return (*list_)[index_]; }
+  IndexIterator& operator++() {
+    ++index_;
+    return *this;
+  }
+  IndexIterator operator++(int) {
+    IndexIterator previous = *this;
+    ++index_;
+    return previous;
+  }
+  bool operator==(const IndexIterator& other) const {
+    return index_ == other.index_;
+  }
+  bool operator!=(const IndexIterator& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  const List* list_ = nullptr;
+  size_t index_ = 0;
+};
+
 // List of errors (if any) for a Bazel build in a given workspace.
 struct Report {
   // Represent a compilation error detected
@@ -23,11 +65,170 @@ struct Report {
     std::vector<std::string> context;
   };
 
+  class ErrorList;
+
+  // The context lines of an error in an `ErrorList`.
+  class Context {
+   public:
+    using value_type = std::string_view;
+    using const_iterator = IndexIterator<Context>;
+
+    Context() = default;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string_view operator[](size_t index) const;
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size_}; }
+
+   private:
+    friend class ErrorList;
+    Context(const ErrorList* list, uint32_t first, uint32_t size)
+      : list_(list), first_(first), size_(size) {}
+
+    const ErrorList* list_ = nullptr;
+    uint32_t first_ = 0;
+    uint32_t size_ = 0;
+  };
+
+  // An error of an `ErrorList`, which is only valid while the list is not
+  // modified, like an iterator.
+  struct ErrorView {
+    std::string_view path_in_workspace;
+    int line = -1;
+    int column = -1;
+    std::string_view message;
+    Context context;
+  };
+
+  // The errors of a report, stored compactly: paths are interned, and all
+  // strings are in one buffer. A report then takes a handful of allocations
+  // however many errors it has, so it's cheap to copy and to release. The
+  // errors of each path are chained, so those of a file are found without
+  // scanning the others.
+  class ErrorList {
+   public:
+    using value_type = ErrorView;
+    using const_iterator = IndexIterator<ErrorList>;
+
+    ErrorList() = default;
+    ErrorList(std::initializer_list<Error> errors);
+
+    size_t size() const { return errors_.size(); }
+    bool empty() const { return errors_.empty(); }
+    ErrorView operator[](size_t index) const;
+    ErrorView front() const { return (*this)[0]; }
+    ErrorView back() const { return (*this)[size() - 1]; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size()}; }
+
+    // Returns the indices of the errors in `path`, in increasing order.
+    std::vector<size_t> IndicesInPath(std::string_view path) const;
+    // Returns the indices of the errors in the paths starting with `prefix`,
+    // in increasing order.
+    std::vector<size_t> IndicesUnderPrefix(std::string_view prefix) const;
+
+    void push_back(const Error& error);
+    // Reserves room for `errors`, but not for their strings.
+    void reserve(size_t errors) { errors_.reserve(errors); }
+    void clear();
+
+    // Returns the memory allocated by the list.
+    size_t HeapBytes() const;
+
+   private:
+    friend class Context;
+
+    // Where a string is in `buffer_`.
+    struct Extent {
+      uint32_t offset = 0;
+      uint32_t size = 0;
+    };
+
+    static constexpr uint32_t kNoError = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t kNoPath = std::numeric_limits<uint32_t>::max();
+
+    // An interned path, with the first and last of its errors.
+    struct Path {
+      Extent name;
+      uint32_t first_error = kNoError;
+      uint32_t last_error = kNoError;
+    };
+
+    struct CompactError {
+      uint32_t path = 0;
+      int32_t line = -1;
+      int32_t column = -1;
+      Extent message;
+      uint32_t first_context = 0;
+      uint32_t context_size = 0;
+      // The next error in the same path, if any.
+      uint32_t next_in_path = kNoError;
+    };
+
+    std::string_view View(Extent extent) const {
+      return std::string_view(buffer_).substr(extent.offset, extent.size);
+    }
+    // Appends `string` to `buffer_`, which must stay addressable by an
+    // `Extent`, so at most 4GiB.
+    Extent Append(std::string_view string);
+    // Returns the index of `path` in `paths_`, or `kNoPath`.
+    uint32_t Find(std::string_view path) const;
+    // Returns the index of `path` in `paths_`, appending it if new.
+    uint32_t Intern(std::string_view path);
+    // Appends the indices of the errors of `path` to `indices`.
+    void AppendIndicesOf(const Path& path, std::vector<size_t>& indices) const;
+
+    std::string buffer_;
+    std::vector<Path> paths_;
+    // The index in `paths_` of each path, by the hash of its name, as names
+    // move with `buffer_`. A path whose hash is taken, which is unlikely, is
+    // only found by a scan.
+    absl::flat_hash_map<size_t, uint32_t> path_by_hash_;
+    std::vector<Extent> context_;
+    std::vector<CompactError> errors_;
+  };
+
+  // Whether the build is still running, in which case more errors may come.
+  enum class Status { kRunning, kFinished };
+
+  // A previous version of the report of the same build, which had the first
+  // `errors` of its errors.
+  struct PastVersion {
+    uint64_t version = 0;
+    size_t errors = 0;
+  };
+
   std::filesystem::path workspace_path = "";
+  // The Bazel invocation which the report is for, as concurrent invocations
+  // in the same workspace each have their report.
+  std::string invocation_id;
   absl::Time time = absl::UnixEpoch();
-  std::vector<Error> errors;
+  ErrorList errors;
+  Status status = Status::kFinished;
+  // Set by the reporter, which increases it with every report added, so a
+  // client knowing the version of a report knows whether it changed.
+  uint64_t version = 0;
+  // Set by the reporter to the latest previous versions for the same build,
+  // oldest first, so their errors are known to be a prefix of `errors`.
+  std::vector<PastVersion> past_versions;
 };
 
+inline std::string_view Report::Context::operator[](size_t index) const {
+  return list_->View(list_->context_[first_ + index]);
+}
+
+inline Report::ErrorView Report::ErrorList::operator[](size_t index) const {
+  const CompactError& error = errors_[index];
+  return {
+    .path_in_workspace = View(paths_[error.path].name),
+    .line = error.line,
+    .column = error.column,
+    .message = View(error.message),
+    .context = Context(this, error.first_context, error.context_size),
+  };
+}
+
 }  // namespace gimli
 
 #endif  // _GIMLI_REPORT_H_
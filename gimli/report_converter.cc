@@ -0,0 +1,67 @@
+#include "gimli/report_converter.h"
+
+#include <cstddef>
+
+#include "absl/time/time.h"
+#include "gimli/report.h"
+#include "gimli/report.pb.h"
+#include "google/protobuf/util/time_util.h"
+
+namespace gimli {
+using ::google::protobuf::util::TimeUtil;
+
+void ToProto(const Report& report, proto::Report& report_proto,
+             size_t first_error) {
+  report_proto.set_workspace_path(report.workspace_path);
+  if (!report.invocation_id.empty()) {
+    report_proto.set_invocation_id(report.invocation_id);
+  }
+  *report_proto.mutable_time() =
+    TimeUtil::NanosecondsToTimestamp(absl::ToUnixNanos(report.time));
+  report_proto.set_status(report.status == Report::Status::kRunning
+                            ? proto::Report::STATUS_RUNNING
+                            : proto::Report::STATUS_FINISHED);
+
+  if (first_error < report.errors.size()) {
+    report_proto.mutable_errors()->Reserve(
+      static_cast<int>(report.errors.size() - first_error));
+  }
+  for (size_t i = first_error; i < report.errors.size(); ++i) {
+    ToProto(report.errors[i], *report_proto.add_errors());
+  }
+}
+
+void ToProto(const Report::ErrorView& error,
+             proto::Report::Error& error_proto) {
+  error_proto.set_path_in_workspace(error.path_in_workspace);
+  error_proto.set_line(error.line);
+  if (error.column != -1) error_proto.set_column(error.column);
+  error_proto.set_message(error.message);
+  for (const auto& context : error.context) {
+    error_proto.add_context(context);
+  }
+}
+
+void FromProto(const proto::Report& report_proto, Report& report) {
+  report.workspace_path = report_proto.workspace_path();
+  report.invocation_id = report_proto.invocation_id();
+  report.time =
+    absl::FromUnixNanos(TimeUtil::TimestampToNanoseconds(report_proto.time()));
+  report.status = report_proto.status() == proto::Report::STATUS_RUNNING
+                    ? Report::Status::kRunning
+                    : Report::Status::kFinished;
+
+  report.errors.clear();
+  report.errors.reserve(report_proto.errors_size());
+  for (const auto& error_proto : report_proto.errors()) {
+    report.errors.push_back({
+      .path_in_workspace = error_proto.path_in_workspace(),
+      .line = error_proto.line(),
+      .column = error_proto.has_column() ? error_proto.column() : -1,
+      .message = error_proto.message(),
+      .context = {error_proto.context().begin(), error_proto.context().end()},
+    });
+  }
+}
+
+}  // namespace gimli
@@ -0,0 +1,24 @@
+#ifndef _GIMLI_REPORT_CONVERTER_H_
+#define _GIMLI_REPORT_CONVERTER_H_
+
+#include <cstddef>
+
+#include "gimli/report.h"
+#include "gimli/report.pb.h"
+
+namespace gimli {
+
+// Fills `report_proto` with `report`, keeping only its errors from index
+// `first_error` onward, e.g. to send only the errors added to a report.
+void ToProto(const Report& report, proto::Report& report_proto,
+             size_t first_error = 0);
+
+// Fills `error_proto` with `error`.
+void ToProto(const Report::ErrorView& error, proto::Report::Error& error_proto);
+
+// Fills `report` with `report_proto`, the inverse of `ToProto`.
+void FromProto(const proto::Report& report_proto, Report& report);
+
+}  // namespace gimli
+
+#endif  // _GIMLI_REPORT_CONVERTER_H_
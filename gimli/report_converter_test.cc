@@ -0,0 +1,79 @@
+#include "gimli/report_converter.h"
+
+#include "absl/time/time.h"
+#include "gimli/report.h"
+#include "gimli/report.pb.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "protobuf-matchers/protocol-buffer-matchers.h"
+
+namespace gimli {
+namespace {
+using ::protobuf_matchers::EqualsProto;
+using ::testing::ElementsAre;
+
+TEST(ReportConverterTest, ConvertsBackAndForth) {
+  const Report report{
+    .workspace_path = "/some/project",
+    .time = absl::FromUnixSeconds(1764368148) + absl::Milliseconds(324),
+    .errors = {{
+                 .path_in_workspace = "some/file.cc",
+                 .line = 6,
+                 .column = 16,
+                 .message = "error: use of undeclared identifier 'y'",
+                 .context = {"    6 |   std::cout << y << std::endl;"},
+               },
+               {
+                 .path_in_workspace = "some/other_file.cc",
+                 .line = 1,
+                 .message = "error: without column",
+               }},
+    .status = Report::Status::kRunning,
+  };
+  proto::Report report_proto;
+  ToProto(report, report_proto);
+  EXPECT_THAT(report_proto, EqualsProto(R"pb(
+                workspace_path: "/some/project"
+                time { seconds: 1764368148 nanos: 324000000 }
+                errors {
+                  path_in_workspace: "some/file.cc"
+                  line: 6
+                  column: 16
+                  message: "error: use of undeclared identifier 'y'"
+                  context: "    6 |   std::cout << y << std::endl;"
+                }
+                errors {
+                  path_in_workspace: "some/other_file.cc"
+                  line: 1
+                  message: "error: without column"
+                }
+                status: STATUS_RUNNING
+              )pb"));
+
+  Report converted;
+  FromProto(report_proto, converted);
+  EXPECT_EQ(converted.workspace_path, report.workspace_path);
+  EXPECT_EQ(converted.time, report.time);
+  EXPECT_EQ(converted.status, report.status);
+  ASSERT_EQ(converted.errors.size(), 2);
+  EXPECT_EQ(converted.errors[0].path_in_workspace, "some/file.cc");
+  EXPECT_EQ(converted.errors[0].line, 6);
+  EXPECT_EQ(converted.errors[0].column, 16);
+  EXPECT_EQ(converted.errors[0].message,
+            "error: use of undeclared identifier 'y'");
+  EXPECT_THAT(converted.errors[0].context,
+              ElementsAre("    6 |   std::cout << y << std::endl;"));
+  EXPECT_EQ(converted.errors[1].column, -1);
+}
+
+TEST(ReportConverterTest, KeepsErrorsFromFirstError) {
+  Report report{.workspace_path = "/some/project"};
+  for (int i = 0; i < 3; ++i) report.errors.push_back({.line = i + 1});
+  proto::Report report_proto;
+  ToProto(report, report_proto, /*first_error=*/2);
+  ASSERT_EQ(report_proto.errors_size(), 1);
+  EXPECT_EQ(report_proto.errors(0).line(), 3);
+}
+
+}  // namespace
+}  // namespace gimli
@@ -0,0 +1,324 @@
+#include "gimli/report_store.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "absl/base/nullability.h"
+#include "absl/cleanup/cleanup.h"
+#include "absl/crc/crc32c.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/report.h"
+#include "gimli/report.pb.h"
+#include "gimli/report_converter.h"
+#include "gimli/reporter.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace gimli {
+namespace {
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::internal::WireFormatLite;
+
+// The first bytes of the file, identifying its format.
+constexpr std::string_view kMagic = "GIMLIRS1";
+
+// A record is the size and the CRC32C of its payload, then its payload,
+// which is a serialized `proto::Report`.
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+// The log is compacted when it has more records than this, and more than
+// twice as many as workspaces.
+constexpr size_t kMinRecordsToCompact = 1024;
+
+absl::Status ErrnoToStatus(std::string_view what,
+                           const std::filesystem::path& path) {
+  return absl::InternalError(
+    absl::StrCat(what, " ", path.string(), ": ", std::strerror(errno)));
+}
+
+void PutUint32(uint32_t value, char* absl_nonnull bytes) {
+  for (int i = 0; i < 4; ++i) bytes[i] = static_cast<char>(value >> (8 * i));
+}
+
+uint32_t GetUint32(const char* absl_nonnull bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+  }
+  return value;
+}
+
+uint32_t Crc32cOf(std::string_view bytes) {
+  return static_cast<uint32_t>(absl::ComputeCrc32c(bytes));
+}
+
+bool WriteAll(int fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    const ssize_t written = ::write(fd, bytes.data(), bytes.size());
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    bytes.remove_prefix(written);
+  }
+  return true;
+}
+
+bool ReadAll(int fd, off_t offset, size_t size, std::string& bytes) {
+  bytes.resize(size);
+  size_t read = 0;
+  while (read < size) {
+    const ssize_t result =
+      ::pread(fd, bytes.data() + read, size - read, offset + read);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    read += result;
+  }
+  return true;
+}
+
+absl::Status SyncDirectory(const std::filesystem::path& path) {
+  const int fd =
+    ::open(path.empty() ? "." : path.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return ErrnoToStatus("Cannot open", path);
+  const bool synced = ::fsync(fd) == 0;
+  const auto status =
+    synced ? absl::OkStatus() : ErrnoToStatus("Cannot sync", path);
+  ::close(fd);
+  return status;
+}
+
+// Returns the workspace of a serialized report, without parsing the rest.
+std::string_view WorkspaceOf(std::string_view payload) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(payload.data()),
+                         static_cast<int>(payload.size()));
+  while (const uint32_t tag = input.ReadTag()) {
+    if (WireFormatLite::GetTagFieldNumber(tag) ==
+          proto::Report::kWorkspacePathFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+          WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint32_t length;
+      if (!input.ReadVarint32(&length)) return {};
+      const auto position = static_cast<size_t>(input.CurrentPosition());
+      return payload.substr(position, length);
+    }
+    if (!WireFormatLite::SkipField(&input, tag)) return {};
+  }
+  return {};
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<ReportStore>> ReportStore::Open(
+  std::filesystem::path path, Reporter& reporter) {
+  // A compaction interrupted by a crash leaves its new file behind.
+  std::error_code error;
+  std::filesystem::remove(std::filesystem::path(path) += ".tmp", error);
+
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) return ErrnoToStatus("Cannot open", path);
+  // The constructor is private, so `std::make_unique` can't be used.
+  std::unique_ptr<ReportStore> store(new ReportStore(std::move(path), fd));
+
+  auto reports = store->Load();
+  if (!reports.ok()) return reports.status();
+  for (auto& report : *reports) reporter.AddReport(std::move(report));
+
+  // Running builds will be rebuilt anyway, so only finished ones are stored.
+  // Listeners must be fast, so the report is only copied for the writer.
+  store->subscription_ =
+    reporter.Subscribe([store = store.get()](const Report& report) {
+      if (report.status != Report::Status::kFinished) return;
+      store->appends_->Post([store, report]() {
+        if (auto status = store->Append(report); !status.ok()) {
+          LOG(ERROR) << "Cannot store the report of " << report.workspace_path
+                     << ": " << status;
+        }
+      });
+    });
+  return store;
+}
+
+ReportStore::~ReportStore() {
+  // Unsubscribe first, so no report is posted while the pending ones are
+  // appended, and the file is closed once they are.
+  subscription_ = {};
+  writer_.reset();
+  ::close(fd_);
+}
+
+absl::StatusOr<std::vector<Report>> ReportStore::Load() {
+  const auto start = absl::Now();
+  struct stat stat;
+  if (::fstat(fd_, &stat) != 0) return ErrnoToStatus("Cannot stat", path_);
+  if (stat.st_size == 0) {
+    if (!WriteAll(fd_, kMagic)) return ErrnoToStatus("Cannot write", path_);
+    size_ = kMagic.size();
+    return std::vector<Report>();
+  }
+
+  // The file is mapped rather than read, and only the latest record of each
+  // workspace is parsed.
+  const auto file_size = static_cast<size_t>(stat.st_size);
+  void* const mapped =
+    ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (mapped == MAP_FAILED) return ErrnoToStatus("Cannot map", path_);
+  auto _ = absl::MakeCleanup([&]() { ::munmap(mapped, file_size); });
+  const std::string_view file(static_cast<const char*>(mapped), file_size);
+  if (!absl::StartsWith(file, kMagic)) {
+    return absl::DataLossError(
+      absl::StrCat(path_.string(), " is not a report store"));
+  }
+
+  std::unordered_map<std::string_view, std::string_view> payloads;
+  size_t offset = kMagic.size();
+  while (file.size() - offset >= kHeaderSize) {
+    const size_t size = GetUint32(file.data() + offset);
+    const uint32_t crc32c = GetUint32(file.data() + offset + sizeof(uint32_t));
+    if (size > file.size() - offset - kHeaderSize) break;
+    const auto payload = file.substr(offset + kHeaderSize, size);
+    if (Crc32cOf(payload) != crc32c) break;
+    const auto workspace = WorkspaceOf(payload);
+    payloads[workspace] = payload;
+    latest_[std::string(workspace)] = {static_cast<off_t>(offset),
+                                       kHeaderSize + size};
+    offset += kHeaderSize + size;
+    ++records_;
+  }
+  if (offset != file.size()) {
+    LOG(WARNING) << "Dropping " << file.size() - offset
+                 << " bytes of incomplete or corrupted records from " << path_;
+    if (::ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+      return ErrnoToStatus("Cannot truncate", path_);
+    }
+  }
+  size_ = static_cast<off_t>(offset);
+
+  std::vector<Report> reports;
+  reports.reserve(payloads.size());
+  for (const auto& [workspace, payload] : payloads) {
+    proto::Report report_proto;
+    if (!report_proto.ParseFromArray(payload.data(),
+                                     static_cast<int>(payload.size()))) {
+      LOG(WARNING) << "Ignoring the invalid report of " << workspace;
+      continue;
+    }
+    FromProto(report_proto, reports.emplace_back());
+  }
+  LOG(INFO) << "Loaded " << reports.size() << " reports from " << records_
+            << " records of " << path_ << " in " << absl::Now() - start;
+  return reports;
+}
+
+absl::Status ReportStore::Append(const Report& report) {
+  std::string workspace = report.workspace_path.string();
+  std::scoped_lock lock(mutex_);
+  if (const auto it = latest_.find(workspace);
+      it != latest_.end() && report.version < it->second.version) {
+    return absl::OkStatus();
+  }
+
+  proto::Report report_proto;
+  ToProto(report, report_proto);
+  auto extent = AppendRecord(report_proto.SerializeAsString());
+  if (!extent.ok()) return extent.status();
+  extent->version = report.version;
+  latest_[std::move(workspace)] = *extent;
+  ++records_;
+  if (records_ >= kMinRecordsToCompact && records_ > 2 * latest_.size()) {
+    return Compact();
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<ReportStore::Extent> ReportStore::AppendRecord(
+  std::string_view payload) {
+  buffer_.resize(kHeaderSize);
+  PutUint32(static_cast<uint32_t>(payload.size()), buffer_.data());
+  PutUint32(Crc32cOf(payload), buffer_.data() + sizeof(uint32_t));
+  buffer_.append(payload);
+  if (!WriteAll(fd_, buffer_)) {
+    const auto status = ErrnoToStatus("Cannot write", path_);
+    // Don't leave a partial record, after which appends would be lost.
+    if (::ftruncate(fd_, size_) != 0) {
+      LOG(ERROR) << ErrnoToStatus("Cannot truncate", path_);
+    }
+    return status;
+  }
+  const Extent extent{.offset = size_, .size = buffer_.size()};
+  size_ += static_cast<off_t>(buffer_.size());
+  return extent;
+}
+
+absl::Status ReportStore::Compact() {
+  const auto start = absl::Now();
+  const auto compacted_path = std::filesystem::path(path_) += ".tmp";
+  const int compacted_fd =
+    ::open(compacted_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (compacted_fd < 0) return ErrnoToStatus("Cannot open", compacted_path);
+  auto close_compacted = absl::MakeCleanup([&]() {
+    ::close(compacted_fd);
+    ::unlink(compacted_path.c_str());
+  });
+
+  if (!WriteAll(compacted_fd, kMagic)) {
+    return ErrnoToStatus("Cannot write", compacted_path);
+  }
+  std::unordered_map<std::string, Extent> compacted;
+  off_t compacted_size = kMagic.size();
+  std::string record;
+  for (const auto& [workspace, extent] : latest_) {
+    if (!ReadAll(fd_, extent.offset, extent.size, record)) {
+      return ErrnoToStatus("Cannot read", path_);
+    }
+    if (!WriteAll(compacted_fd, record)) {
+      return ErrnoToStatus("Cannot write", compacted_path);
+    }
+    compacted[workspace] = {.offset = compacted_size,
+                            .size = extent.size,
+                            .version = extent.version};
+    compacted_size += static_cast<off_t>(extent.size);
+  }
+  // The new file must be complete on disk before it replaces the log.
+  if (::fsync(compacted_fd) != 0) {
+    return ErrnoToStatus("Cannot sync", compacted_path);
+  }
+  if (::rename(compacted_path.c_str(), path_.c_str()) != 0) {
+    return ErrnoToStatus("Cannot rename", compacted_path);
+  }
+  std::move(close_compacted).Cancel();
+  // The rename must be on disk too, or a crash could bring the old log back.
+  if (auto status = SyncDirectory(path_.parent_path()); !status.ok()) {
+    LOG(ERROR) << status;
+  }
+
+  LOG(INFO) << "Compacted " << records_ << " records of " << path_ << " into "
+            << compacted.size() << " in " << absl::Now() - start;
+  ::close(fd_);
+  fd_ = compacted_fd;
+  size_ = compacted_size;
+  records_ = compacted.size();
+  latest_ = std::move(compacted);
+  return absl::OkStatus();
+}
+
+}  // namespace gimli
@@ -0,0 +1,97 @@
+#ifndef GIMLI_REPORT_STORE_H_
+#define GIMLI_REPORT_STORE_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gimli/report.h"
+#include "gimli/reporter.h"
+#include "gimli/worker_pool.h"
+
+namespace gimli {
+
+// Persists the finished reports of a reporter, so they survive restarts.
+//
+// The store is an append-only log, where each record is a report preceded by
+// its size and CRC32C. A record cut or garbled by a crash is detected, and
+// dropped, when the store is opened. Once most records are outdated by newer
+// reports of the same workspaces, the log is compacted into a new file that
+// atomically replaces it.
+//
+// Reports are appended by a thread of the store, so listeners of the reporter
+// aren't slowed down by the disk.
+class ReportStore {
+ public:
+  // Opens the store at `path`, or creates it, adds its reports to `reporter`,
+  // then appends all the finished reports added to `reporter` until the store
+  // is destroyed, in the background. Reporter's scope must encompass the
+  // scope of the store.
+  static absl::StatusOr<std::unique_ptr<ReportStore>> Open(
+    std::filesystem::path path, Reporter& reporter);
+
+  // Appends the pending reports, then closes the store.
+  ~ReportStore();
+
+  // Appends a report to the log, and compacts the log if needed. The report
+  // is ignored if one of a later version was appended for its workspace, so
+  // the stored one is the latest completed even if concurrent invocations
+  // are notified out of order.
+  absl::Status Append(const Report& report);
+
+ private:
+  // Where the latest record of a workspace is in the file, and the version of
+  // its report, or 0 if it was loaded.
+  struct Extent {
+    off_t offset;
+    size_t size;
+    uint64_t version = 0;
+  };
+
+  ReportStore(std::filesystem::path path, int fd)
+    : path_(std::move(path)), fd_(fd) {}
+
+  // Scans the file, returns the latest report of each workspace, and drops
+  // an incomplete or corrupted tail. Must be called before any `Append`.
+  absl::StatusOr<std::vector<Report>> Load();
+
+  // Writes `payload` as a record at the end of the file, and returns where.
+  // Must be called with `mutex_` held.
+  absl::StatusOr<Extent> AppendRecord(std::string_view payload);
+
+  // Rewrites the latest records in a new file, and replaces the log with it.
+  // Must be called with `mutex_` held.
+  absl::Status Compact();
+
+  const std::filesystem::path path_;
+  std::mutex mutex_;
+  int fd_;
+  off_t size_ = 0;
+  size_t records_ = 0;
+  std::unordered_map<std::string, Extent> latest_;
+  // Reused across appends, to serialize records before writing them.
+  std::string buffer_;
+
+  // Appends the reports of the reporter, one at a time, in order.
+  std::unique_ptr<WorkerPool> writer_ = std::make_unique<WorkerPool>(1);
+  std::shared_ptr<WorkerPool::Sequence> appends_ = writer_->NewSequence();
+
+  // Last member, so it's destroyed first and no report is appended to a
+  // partially destroyed store.
+  Reporter::Subscription subscription_;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_REPORT_STORE_H_
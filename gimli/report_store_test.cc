@@ -0,0 +1,204 @@
+#include "gimli/report_store.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "absl/status/status_matchers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "gimli/report.h"
+#include "gimli/reporter.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gimli {
+namespace {
+using ::absl_testing::IsOk;
+using ::testing::ElementsAre;
+using ::testing::Field;
+using ::testing::IsNull;
+using ::testing::Lt;
+using ::testing::NotNull;
+using ::testing::Pointee;
+using ::testing::SizeIs;
+
+std::filesystem::path NewPath(const std::string& name) {
+  const auto path = std::filesystem::path(testing::TempDir()) / name;
+  std::filesystem::remove(path);
+  return path;
+}
+
+Report MakeReport(const std::string& workspace, int line,
+                  Report::Status status = Report::Status::kFinished) {
+  return {
+    .workspace_path = workspace,
+    .time = absl::FromUnixSeconds(1764368148),
+    .errors = {{
+      .path_in_workspace = "main.cc",
+      .line = line,
+      .column = 3,
+      .message = "error: some error",
+      .context = {"  some context"},
+    }},
+    .status = status,
+  };
+}
+
+TEST(ReportStoreTest, PersistsFinishedReports) {
+  const auto path = NewPath("persists.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    reporter.AddReport(MakeReport("/finished", 1));
+    reporter.AddReport(MakeReport("/running", 1, Report::Status::kRunning));
+  }
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  const auto report = reporter.GetReportFor("/finished");
+  ASSERT_THAT(report, NotNull());
+  EXPECT_EQ(report->time, absl::FromUnixSeconds(1764368148));
+  ASSERT_THAT(report->errors, SizeIs(1));
+  EXPECT_EQ(report->errors[0].path_in_workspace, "main.cc");
+  EXPECT_EQ(report->errors[0].line, 1);
+  EXPECT_EQ(report->errors[0].column, 3);
+  EXPECT_EQ(report->errors[0].message, "error: some error");
+  EXPECT_EQ(report->errors[0].context[0], "  some context");
+  EXPECT_THAT(reporter.GetReportFor("/running"), IsNull());
+}
+
+TEST(ReportStoreTest, KeepsLatestReport) {
+  const auto path = NewPath("latest.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    reporter.AddReport(MakeReport("/project", 1));
+    reporter.AddReport(MakeReport("/project", 2));
+  }
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  EXPECT_THAT(reporter.GetReportFor("/project"),
+              Pointee(Field(&Report::errors,
+                            ElementsAre(Field(&Report::ErrorView::line, 2)))));
+}
+
+TEST(ReportStoreTest, KeepsLatestVersion) {
+  const auto path = NewPath("version.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    // Concurrent invocations may be notified out of order.
+    auto latest = MakeReport("/project", 2);
+    latest.version = 2;
+    auto earlier = MakeReport("/project", 1);
+    earlier.version = 1;
+    ASSERT_THAT((*store)->Append(latest), IsOk());
+    ASSERT_THAT((*store)->Append(earlier), IsOk());
+  }
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  EXPECT_THAT(
+    reporter.GetReportFor("/project"),
+    Pointee(Field(&Report::errors,
+                  ElementsAre(Field(&Report::ErrorView::line, 2)))));
+}
+
+TEST(ReportStoreTest, DropsTruncatedRecord) {
+  const auto path = NewPath("truncated.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    reporter.AddReport(MakeReport("/first", 1));
+    reporter.AddReport(MakeReport("/second", 1));
+  }
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  EXPECT_THAT(reporter.GetReportFor("/first"), NotNull());
+  EXPECT_THAT(reporter.GetReportFor("/second"), IsNull());
+
+  // Reports appended after the truncated record are not lost.
+  reporter.AddReport(MakeReport("/third", 1));
+  store->reset();
+  Reporter reopened;
+  ASSERT_THAT(ReportStore::Open(path, reopened), IsOk());
+  EXPECT_THAT(reopened.GetReportFor("/first"), NotNull());
+  EXPECT_THAT(reopened.GetReportFor("/third"), NotNull());
+}
+
+TEST(ReportStoreTest, DropsCorruptedRecord) {
+  const auto path = NewPath("corrupted.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    reporter.AddReport(MakeReport("/first", 1));
+    reporter.AddReport(MakeReport("/second", 1));
+  }
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(-1, std::ios::end);
+    file.put('!');
+  }
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  EXPECT_THAT(reporter.GetReportFor("/first"), NotNull());
+  EXPECT_THAT(reporter.GetReportFor("/second"), IsNull());
+}
+
+TEST(ReportStoreTest, RejectsOtherFiles) {
+  const auto path = NewPath("other.store");
+  std::ofstream(path) << "Not a store";
+
+  Reporter reporter;
+  EXPECT_FALSE(ReportStore::Open(path, reporter).ok());
+}
+
+TEST(ReportStoreTest, Compacts) {
+  const auto path = NewPath("compacted.store");
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    reporter.AddReport(MakeReport("/project", 0));
+  }
+  const auto one_report_size = std::filesystem::file_size(path);
+  {
+    Reporter reporter;
+    auto store = ReportStore::Open(path, reporter);
+    ASSERT_THAT(store, IsOk());
+    for (int i = 1; i <= 5000; ++i) {
+      reporter.AddReport(MakeReport(absl::StrCat("/project", i % 2), i));
+    }
+  }
+  EXPECT_THAT(std::filesystem::file_size(path), Lt(1000 * one_report_size));
+
+  Reporter reporter;
+  auto store = ReportStore::Open(path, reporter);
+  ASSERT_THAT(store, IsOk());
+  EXPECT_THAT(
+    reporter.GetReportFor("/project0"),
+    Pointee(Field(&Report::errors,
+                  ElementsAre(Field(&Report::ErrorView::line, 5000)))));
+  EXPECT_THAT(
+    reporter.GetReportFor("/project1"),
+    Pointee(Field(&Report::errors,
+                  ElementsAre(Field(&Report::ErrorView::line, 4999)))));
+}
+
+}  // namespace
+}  // namespace gimli
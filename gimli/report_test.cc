@@ -0,0 +1,102 @@
+#include "gimli/report.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gimli {
+namespace {
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(ReportTest, StoresErrors) {
+  Report::ErrorList errors = {
+    {
+      .path_in_workspace = "main.cc",
+      .line = 5,
+      .column = 3,
+      .message = "error: first",
+      .context = {"Here...", "...or there"},
+    },
+    {
+      .path_in_workspace = "other.cc",
+      .line = 7,
+      .message = "error: second",
+    },
+  };
+  errors.push_back({.path_in_workspace = "main.cc", .message = "error: third"});
+
+  ASSERT_EQ(errors.size(), 3);
+  EXPECT_EQ(errors[0].path_in_workspace, "main.cc");
+  EXPECT_EQ(errors[0].line, 5);
+  EXPECT_EQ(errors[0].column, 3);
+  EXPECT_EQ(errors[0].message, "error: first");
+  EXPECT_THAT(errors[0].context, ElementsAre("Here...", "...or there"));
+  EXPECT_EQ(errors[1].path_in_workspace, "other.cc");
+  EXPECT_EQ(errors[1].column, -1);
+  EXPECT_THAT(errors[1].context, IsEmpty());
+  EXPECT_EQ(errors.back().path_in_workspace, "main.cc");
+  EXPECT_EQ(errors.back().message, "error: third");
+
+  std::vector<std::string> messages;
+  for (const auto& error : errors) messages.emplace_back(error.message);
+  EXPECT_THAT(messages,
+              ElementsAre("error: first", "error: second", "error: third"));
+}
+
+TEST(ReportTest, InternsPaths) {
+  Report::ErrorList once;
+  once.push_back({.path_in_workspace = "some/long/path/to/a/file.cc"});
+  Report::ErrorList twice = once;
+  twice.push_back({.path_in_workspace = "some/long/path/to/a/file.cc"});
+  twice.push_back({.path_in_workspace = "some/long/path/to/a/file.cc"});
+  // Only the errors themselves are added, not their path.
+  EXPECT_EQ(twice[2].path_in_workspace.data(),
+            twice[0].path_in_workspace.data());
+}
+
+TEST(ReportTest, InternsManyPaths) {
+  Report::ErrorList errors;
+  for (int i = 0; i < 2000; ++i) {
+    errors.push_back({.path_in_workspace = "file" + std::to_string(i % 1000)});
+  }
+  EXPECT_EQ(errors[1500].path_in_workspace.data(),
+            errors[500].path_in_workspace.data());
+  EXPECT_THAT(errors.IndicesInPath("file999"), ElementsAre(999, 1999));
+  EXPECT_THAT(errors.IndicesInPath("file1000"), IsEmpty());
+}
+
+TEST(ReportTest, IndexesErrorsByPath) {
+  Report::ErrorList errors = {
+    {.path_in_workspace = "a/x.cc"}, {.path_in_workspace = "a/y.cc"},
+    {.path_in_workspace = "b/z.cc"}, {.path_in_workspace = "a/x.cc"},
+    {.path_in_workspace = "a/y.cc"},
+  };
+  EXPECT_THAT(errors.IndicesInPath("a/x.cc"), ElementsAre(0, 3));
+  EXPECT_THAT(errors.IndicesInPath("b/z.cc"), ElementsAre(2));
+  EXPECT_THAT(errors.IndicesInPath("a"), IsEmpty());
+  EXPECT_THAT(errors.IndicesUnderPrefix("a/"), ElementsAre(0, 1, 3, 4));
+  EXPECT_THAT(errors.IndicesUnderPrefix(""), ElementsAre(0, 1, 2, 3, 4));
+  EXPECT_THAT(errors.IndicesUnderPrefix("c/"), IsEmpty());
+
+  // A copy keeps the index, and extends it independently.
+  Report::ErrorList copy = errors;
+  copy.push_back({.path_in_workspace = "b/z.cc"});
+  EXPECT_THAT(copy.IndicesInPath("b/z.cc"), ElementsAre(2, 5));
+  EXPECT_THAT(errors.IndicesInPath("b/z.cc"), ElementsAre(2));
+}
+
+TEST(ReportTest, CopiesAreIndependent) {
+  Report::ErrorList errors = {{.message = "error: first"}};
+  Report::ErrorList copy = errors;
+  errors.clear();
+  errors.push_back({.message = "error: other"});
+  ASSERT_EQ(copy.size(), 1);
+  EXPECT_EQ(copy[0].message, "error: first");
+  EXPECT_EQ(errors[0].message, "error: other");
+}
+
+}  // namespace
+}  // namespace gimli
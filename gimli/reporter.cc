@@ -1,36 +1,392 @@
 #include "gimli/reporter.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
+
+#include "absl/base/nullability.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/metrics.h"
+#include "gimli/report.h"
 
 namespace gimli {
 namespace {
 
-bool is_subpath(const std::filesystem::path& path,
-                const std::filesystem::path& base) {
-  const auto pair =
-    std::mismatch(path.begin(), path.end(), base.begin(), base.end());
-  return (pair.second == base.end());
+// Finished invocations kept per workspace, besides the latest completed, so
+// they can still be gotten by their id.
+constexpr size_t kMaxFinishedInvocations = 8;
+
+// Past versions kept per report, so clients refreshing a running build's
+// report only get its new errors.
+constexpr size_t kMaxPastVersions = 16;
+
+// Readers only record a use if the last one is older than this, so that
+// concurrent readers of a report rarely write to it.
+constexpr int64_t kLastUsedResolutionNanos = 10'000'000;
+
+// Returns the heap memory owned by `string`, if not stored inline.
+size_t HeapBytesOf(const std::string& string) {
+  static const size_t kInlineCapacity = std::string().capacity();
+  return string.capacity() > kInlineCapacity ? string.capacity() + 1 : 0;
 }
 
 }  // namespace
 
+size_t Reporter::ByteSizeOf(const Report& report) {
+  return sizeof(Report) + HeapBytesOf(report.workspace_path.native()) +
+         HeapBytesOf(report.invocation_id) + report.errors.HeapBytes() +
+         report.past_versions.capacity() * sizeof(Report::PastVersion);
+}
+
+Reporter::Components Reporter::ComponentsOf(
+  const std::filesystem::path& path) {
+  Components components;
+  for (const auto& component : path.lexically_normal()) {
+    // A trailing separator yields an empty component, which is not a level.
+    if (component.empty()) continue;
+    components.push_back(component.native());
+  }
+  return components;
+}
+
+Reporter::Subscription::Subscription(Subscription&& other) noexcept
+  : reporter_(std::exchange(other.reporter_, nullptr)),
+    listener_(other.listener_) {}
+
+Reporter::Subscription& Reporter::Subscription::operator=(
+  Subscription&& other) noexcept {
+  if (this != &other) {
+    // Unsubscribes the current listener when going out of scope.
+    Subscription previous = std::move(*this);
+    reporter_ = std::exchange(other.reporter_, nullptr);
+    listener_ = other.listener_;
+  }
+  return *this;
+}
+
+Reporter::Subscription::~Subscription() {
+  if (reporter_ == nullptr) return;
+  std::scoped_lock lock(reporter_->listeners_mutex_);
+  reporter_->listeners_.erase(listener_);
+}
+
+Reporter::Subscription Reporter::Subscribe(Listener listener) const {
+  std::scoped_lock lock(listeners_mutex_);
+  listeners_.push_back(std::move(listener));
+  return Subscription(this, std::prev(listeners_.end()));
+}
+
 void Reporter::AddReport(Report report) {
-  std::scoped_lock lock(mutex_);
-  per_workspace_path_reports_[(report.workspace_path).lexically_normal()] =
-    std::move(report);
+  auto snapshot = std::make_shared<Report>(std::move(report));
+  const Slot* published = Publish(snapshot);
+  if (options_.max_bytes > 0 &&
+      bytes_.load(std::memory_order_relaxed) > options_.max_bytes) {
+    Evict(published);
+  }
+
+  std::shared_lock lock(listeners_mutex_);
+  for (const auto& listener : listeners_) {
+    listener(*snapshot);
+  }
+}
+
+Reporter::Shard& Reporter::ShardOf(const Components& components) {
+  size_t hash = 0;
+  for (const auto& component : components) {
+    hash = hash * 31 + std::hash<std::string>()(component);
+  }
+  return shards_[hash % kShards];
+}
+
+Reporter::Counters& Reporter::CountersOfThread() const {
+  static std::atomic<size_t> next_index = 0;
+  thread_local const size_t index =
+    next_index.fetch_add(1, std::memory_order_relaxed) % kShards;
+  return counters_[index];
 }
 
-std::optional<Report> Reporter::GetReportFor(
-  std::filesystem::path workspace_path) const {
-  std::scoped_lock lock(mutex_);
-  const auto search_key = (workspace_path).lexically_normal();
-  for (const auto& [key, report] : per_workspace_path_reports_) {
-    if (is_subpath(search_key, key)) return report;
+const Reporter::Slot* Reporter::Publish(std::shared_ptr<Report> snapshot) {
+  const auto components = ComponentsOf(snapshot->workspace_path);
+  Shard& shard = ShardOf(components);
+
+  // Workspaces of the shard are only added or removed with its lock held, so
+  // whether this one is known can't change until it's released.
+  std::scoped_lock lock(shard.mutex);
+  std::optional<ScopedTimer> timer;
+  if (options_.lock_hold != nullptr) timer.emplace(*options_.lock_hold);
+  const auto root = std::atomic_load(&root_);
+
+  // Only the reports change if the workspace is already known.
+  const Node* node = root.get();
+  for (const auto& component : components) {
+    const auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      node = nullptr;
+      break;
+    }
+    node = it->second.get();
+  }
+  Entry* entry;
+  if (node != nullptr && node->slot != nullptr) {
+    entry = &shard.entries.at(node->slot.get());
+    // Reports of the workspace are only replaced with the lock held, so
+    // versions increase in the order of the replacements.
+    const auto& invocations = entry->slot->workspace->invocations;
+    const auto previous = invocations.find(snapshot->invocation_id);
+    SetVersions(
+      previous == invocations.end() ? nullptr : previous->second.get(),
+      *snapshot);
+    std::atomic_store(
+      &entry->slot->workspace,
+      WithReport(entry->slot->workspace.get(), std::move(snapshot)));
+  } else {
+    // Otherwise publish a new root, with a copy of the nodes along the path.
+    SetVersions(nullptr, *snapshot);
+    auto slot = std::make_shared<Slot>();
+    slot->workspace = WithReport(nullptr, std::move(snapshot));
+    entry = &shard.entries[slot.get()];
+    entry->slot = slot;
+    entry->components = components;
+    std::scoped_lock root_lock(root_mutex_);
+    std::atomic_store(&root_, WithSlot(std::atomic_load(&root_).get(),
+                                       components.begin(), components.end(),
+                                       std::move(slot)));
+  }
+  entry->slot->last_used.store(absl::GetCurrentTimeNanos(),
+                               std::memory_order_relaxed);
+
+  size_t bytes = 0;
+  for (const auto& [_, report] : entry->slot->workspace->invocations) {
+    bytes += ByteSizeOf(*report);
+  }
+  bytes_.fetch_add(bytes - entry->bytes, std::memory_order_relaxed);
+  entry->bytes = bytes;
+  entry->reports = entry->slot->workspace->invocations.size();
+  return entry->slot.get();
+}
+
+void Reporter::SetVersions(const Report* absl_nullable previous,
+                           Report& report) {
+  report.version = next_version_.fetch_add(1, std::memory_order_relaxed);
+  report.past_versions.clear();
+  // Errors are only appended to the report of a build, so the previous
+  // versions of the same build have a prefix of its errors.
+  if (previous == nullptr || previous->time != report.time ||
+      previous->errors.size() > report.errors.size()) {
+    return;
+  }
+  const auto& past = previous->past_versions;
+  const size_t kept = std::min(past.size(), kMaxPastVersions - 1);
+  report.past_versions.reserve(kept + 1);
+  report.past_versions.assign(past.end() - kept, past.end());
+  report.past_versions.push_back(
+    {.version = previous->version, .errors = previous->errors.size()});
+}
+
+std::shared_ptr<const Reporter::Workspace> Reporter::WithReport(
+  const Workspace* absl_nullable workspace,
+  std::shared_ptr<const Report> snapshot) {
+  auto copy = workspace == nullptr ? std::make_shared<Workspace>()
+                                   : std::make_shared<Workspace>(*workspace);
+  if (snapshot->status == Report::Status::kFinished) copy->completed = snapshot;
+  copy->invocations[snapshot->invocation_id] = std::move(snapshot);
+
+  // Drops the oldest finished invocations beyond the limit.
+  std::vector<const Report*> finished;
+  for (const auto& [_, report] : copy->invocations) {
+    if (report->status == Report::Status::kFinished &&
+        report != copy->completed) {
+      finished.push_back(report.get());
+    }
+  }
+  if (finished.size() > kMaxFinishedInvocations) {
+    std::sort(
+      finished.begin(), finished.end(),
+      [](const Report* a, const Report* b) { return a->time > b->time; });
+    for (size_t i = kMaxFinishedInvocations; i < finished.size(); ++i) {
+      copy->invocations.erase(finished[i]->invocation_id);
+    }
+  }
+
+  // A running invocation started after the latest completed one supersedes
+  // it, so a new build replaces the errors of the previous one.
+  copy->current = copy->completed;
+  for (const auto& [_, report] : copy->invocations) {
+    if (report->status == Report::Status::kRunning &&
+        (copy->current == nullptr || report->time > copy->current->time)) {
+      copy->current = report;
+    }
+  }
+  return copy;
+}
+
+void Reporter::Evict() { Evict(nullptr); }
+
+void Reporter::Evict(const Slot* absl_nullable kept) {
+  std::scoped_lock lock(eviction_mutex_);
+  const int64_t expired_before =
+    options_.ttl == absl::InfiniteDuration()
+      ? std::numeric_limits<int64_t>::min()
+      : absl::GetCurrentTimeNanos() - absl::ToInt64Nanoseconds(options_.ttl);
+  // Once over budget, evicts down to 7/8 of it, so that sorting the reports
+  // is amortized over many additions.
+  const size_t max_bytes =
+    options_.max_bytes > 0 &&
+        bytes_.load(std::memory_order_relaxed) > options_.max_bytes
+      ? options_.max_bytes - options_.max_bytes / 8
+      : std::numeric_limits<size_t>::max();
+
+  // The shards are locked one at a time, so builds are never all blocked.
+  // Holding the slots keeps them from being reused by new workspaces.
+  struct Candidate {
+    int64_t last_used;
+    std::shared_ptr<Slot> slot;
+    Shard* shard;
+  };
+  std::vector<Candidate> by_last_use;
+  for (auto& shard : shards_) {
+    std::scoped_lock shard_lock(shard.mutex);
+    for (const auto& [slot, entry] : shard.entries) {
+      if (slot == kept) continue;
+      by_last_use.push_back(
+        {slot->last_used.load(std::memory_order_relaxed), entry.slot, &shard});
+    }
+  }
+  std::sort(by_last_use.begin(), by_last_use.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.last_used < b.last_used;
+            });
+
+  for (const auto& candidate : by_last_use) {
+    if (candidate.last_used >= expired_before &&
+        bytes_.load(std::memory_order_relaxed) <= max_bytes) {
+      break;
+    }
+    std::scoped_lock shard_lock(candidate.shard->mutex);
+    const auto it = candidate.shard->entries.find(candidate.slot.get());
+    // Skips a workspace evicted meanwhile, or used since it was collected.
+    if (it == candidate.shard->entries.end() ||
+        candidate.slot->last_used.load(std::memory_order_relaxed) !=
+          candidate.last_used) {
+      continue;
+    }
+    const auto& components = it->second.components;
+    {
+      std::scoped_lock root_lock(root_mutex_);
+      auto root = WithSlot(std::atomic_load(&root_).get(), components.begin(),
+                           components.end(), nullptr);
+      if (root == nullptr) root = std::make_shared<const Node>();
+      std::atomic_store(&root_, std::move(root));
+    }
+    bytes_.fetch_sub(it->second.bytes, std::memory_order_relaxed);
+    candidate.shard->entries.erase(it);
+    evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::shared_ptr<const Reporter::Node> Reporter::WithSlot(
+  const Node* absl_nullable node, Components::const_iterator begin,
+  Components::const_iterator end, std::shared_ptr<Slot> slot) {
+  auto copy =
+    node == nullptr ? std::make_shared<Node>() : std::make_shared<Node>(*node);
+  if (begin == end) {
+    copy->slot = std::move(slot);
+  } else {
+    const Node* child = nullptr;
+    if (node != nullptr) {
+      const auto it = node->children.find(*begin);
+      if (it != node->children.end()) child = it->second.get();
+    }
+    auto new_child = WithSlot(child, begin + 1, end, std::move(slot));
+    if (new_child == nullptr) {
+      copy->children.erase(*begin);
+    } else {
+      copy->children[*begin] = std::move(new_child);
+    }
+  }
+  if (copy->slot == nullptr && copy->children.empty()) return nullptr;
+  return copy;
+}
+
+template <typename Select>
+std::shared_ptr<const Report> Reporter::Find(const std::filesystem::path& path,
+                                             Select select) const {
+  const auto root = std::atomic_load(&root_);
+  const Node* node = root.get();
+  const Slot* deepest = nullptr;
+  std::shared_ptr<const Report> report;
+  const auto visit = [&](const Slot* absl_nullable slot) {
+    if (slot == nullptr) return;
+    auto selected = select(*std::atomic_load(&slot->workspace));
+    if (selected == nullptr) return;
+    deepest = slot;
+    report = std::move(selected);
+  };
+  visit(node->slot.get());
+  for (const auto& component : path.lexically_normal()) {
+    if (component.empty()) continue;
+    const auto it = node->children.find(component.native());
+    if (it == node->children.end()) break;
+    node = it->second.get();
+    visit(node->slot.get());
+  }
+  Counters& counters = CountersOfThread();
+  if (deepest == nullptr) {
+    counters.misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  counters.hits.fetch_add(1, std::memory_order_relaxed);
+  const int64_t now = absl::GetCurrentTimeNanos();
+  if (now - deepest->last_used.load(std::memory_order_relaxed) >=
+      kLastUsedResolutionNanos) {
+    deepest->last_used.store(now, std::memory_order_relaxed);
+  }
+  return report;
+}
+
+std::shared_ptr<const Report> Reporter::GetReportFor(
+  std::filesystem::path path) const {
+  return Find(path, [](const Workspace& workspace) {
+    return workspace.current;
+  });
+}
+
+std::shared_ptr<const Report> Reporter::GetReportFor(
+  std::filesystem::path path, std::string_view invocation_id) const {
+  return Find(path, [invocation_id](const Workspace& workspace) {
+    const auto it = workspace.invocations.find(std::string(invocation_id));
+    return it == workspace.invocations.end() ? nullptr : it->second;
+  });
+}
+
+Reporter::Stats Reporter::GetStats() const {
+  Stats stats{
+    .evictions = evictions_.load(std::memory_order_relaxed),
+    .bytes = bytes_.load(std::memory_order_relaxed),
+  };
+  for (const auto& counters : counters_) {
+    stats.hits += counters.hits.load(std::memory_order_relaxed);
+    stats.misses += counters.misses.load(std::memory_order_relaxed);
+  }
+  for (const auto& shard : shards_) {
+    std::scoped_lock lock(shard.mutex);
+    for (const auto& [_, entry] : shard.entries) stats.reports += entry.reports;
   }
-  return std::nullopt;
+  return stats;
 }
 
 }  // namespace gimli
@@ -1,26 +1,226 @@
 #ifndef GIMLI_REPORTER_H_
 #define GIMLI_REPORTER_H_
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
 #include <mutex>
-#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "absl/base/nullability.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/metrics.h"
 #include "gimli/report.h"
 
 namespace gimli {
 
 class Reporter {
  public:
-  // Add a report. Any report for the same workspace will be replaced.
+  struct Options {
+    // Total size of the reports kept, beyond which the least recently used
+    // ones are evicted. Zero means unlimited.
+    size_t max_bytes = 0;
+    // Reports neither added nor gotten for this long are evicted.
+    absl::Duration ttl = absl::InfiniteDuration();
+    // If set, records how long adding a report holds the lock of its shard,
+    // in nanoseconds. Must outlive the reporter.
+    Histogram* absl_nullable lock_hold = nullptr;
+  };
+
+  // Counters to size the budget of a reporter.
+  struct Stats {
+    // Calls to `GetReportFor` which found a report, or didn't.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Workspaces evicted, with all their reports, because of the memory
+    // budget or the TTL.
+    uint64_t evictions = 0;
+    // Reports kept, of all invocations, and their total size as counted by
+    // `ByteSizeOf`.
+    size_t reports = 0;
+    size_t bytes = 0;
+  };
+
+  // Called with every report added.
+  using Listener = std::function<void(const Report& report)>;
+
+  // Keeps a listener subscribed until destroyed.
+  class Subscription {
+   public:
+    Subscription() = default;
+    Subscription(Subscription&& other) noexcept;
+    Subscription& operator=(Subscription&& other) noexcept;
+    ~Subscription();
+
+   private:
+    friend class Reporter;
+    Subscription(const Reporter* absl_nonnull reporter,
+                 std::list<Listener>::iterator listener)
+      : reporter_(reporter), listener_(listener) {}
+
+    const Reporter* absl_nullable reporter_ = nullptr;
+    std::list<Listener>::iterator listener_;
+  };
+
+  Reporter() = default;
+  explicit Reporter(Options options) : options_(options) {}
+
+  // Add a report. Any report for the same invocation will be replaced. Least
+  // recently used workspaces are evicted if the budget is exceeded. The
+  // `version` and `past_versions` of the report are set.
   void AddReport(Report report);
 
-  std::optional<Report> GetReportFor(
-    std::filesystem::path workspace_path) const;
+  // Calls `listener` after each `AddReport`, in the thread adding the report,
+  // until the returned subscription is destroyed, which waits for any ongoing
+  // call. A listener must be fast and thread-safe, as reports added by
+  // different threads are notified concurrently, and must not subscribe nor
+  // unsubscribe.
+  [[nodiscard]] Subscription Subscribe(Listener listener) const;
+
+  // Returns the report of the deepest workspace containing `path`, or null.
+  // The report is an immutable snapshot, unaffected by later `AddReport`, and
+  // getting it neither copies it nor waits for reports being added. It isn't
+  // lock-free though: `std::atomic_load` of a shared pointer locks one of a
+  // pool of mutexes of the standard library, just for the load.
+  //
+  // The report of a workspace is the one of its latest completed invocation,
+  // unless an invocation started after that one is running, in which case
+  // it's the report of the latest started.
+  std::shared_ptr<const Report> GetReportFor(std::filesystem::path path) const;
+
+  // Returns the report of `invocation_id`, in the deepest workspace containing
+  // `path` with such an invocation, or null.
+  std::shared_ptr<const Report> GetReportFor(
+    std::filesystem::path path, std::string_view invocation_id) const;
+
+  // Evicts the expired reports, and the least recently used ones if over
+  // budget. Called periodically, since expiring doesn't add any report.
+  void Evict();
+
+  Stats GetStats() const;
+
+  // Returns the memory used by `report`, including its heap allocations.
+  static size_t ByteSizeOf(const Report& report);
 
  private:
-  mutable std::mutex mutex_;
-  std::unordered_map<std::filesystem::path, Report> per_workspace_path_reports_;
+  // The reports of a workspace, by invocation.
+  struct Workspace {
+    std::unordered_map<std::string, std::shared_ptr<const Report>> invocations;
+    // The latest completed invocation, if any.
+    std::shared_ptr<const Report> completed;
+    // The report returned for the workspace.
+    std::shared_ptr<const Report> current;
+  };
+
+  // The reports of a workspace, which are swapped atomically when replaced.
+  struct Slot {
+    std::shared_ptr<const Workspace> workspace;
+    // When the report was last added or gotten, in nanoseconds since epoch.
+    mutable std::atomic<int64_t> last_used = 0;
+  };
+
+  // Reports are indexed by the components of their workspace path, so that
+  // the deepest workspace containing a path is found in one walk down. Nodes
+  // are never modified once published: adding a workspace publishes a new
+  // root, which shares all the untouched nodes with the previous one.
+  struct Node {
+    std::unordered_map<std::string, std::shared_ptr<const Node>> children;
+    std::shared_ptr<Slot> slot;
+  };
+
+  using Components = std::vector<std::string>;
+
+  // What is accounted for each workspace.
+  struct Entry {
+    std::shared_ptr<Slot> slot;
+    Components components;
+    size_t reports = 0;
+    size_t bytes = 0;
+  };
+
+  // Workspaces are spread over shards by the hash of their path. Adding a
+  // report only locks its shard, so builds of unrelated workspaces don't
+  // contend, except to publish a new root when adding a new workspace.
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<const Slot*, Entry> entries;
+  };
+
+  // Counters updated by readers, striped by thread so they don't contend.
+  struct alignas(64) Counters {
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+  };
+
+  static constexpr size_t kShards = 16;
+
+  // Makes `snapshot` the report of its invocation, and returns its slot. Its
+  // versions are set first, as nothing else has it yet.
+  const Slot* absl_nonnull Publish(std::shared_ptr<Report> snapshot);
+
+  // Sets the versions of `report`, which replaces `previous`, if not null.
+  void SetVersions(const Report* absl_nullable previous, Report& report);
+
+  // Returns a copy of `workspace` (or a new one if null) with `snapshot`.
+  static std::shared_ptr<const Workspace> WithReport(
+    const Workspace* absl_nullable workspace,
+    std::shared_ptr<const Report> snapshot);
+
+  // Returns the report that `select` returns for the deepest workspace
+  // containing `path` for which it returns one, or null.
+  template <typename Select>
+  std::shared_ptr<const Report> Find(const std::filesystem::path& path,
+                                     Select select) const;
+
+  // Returns the normalized components of `path`.
+  static Components ComponentsOf(const std::filesystem::path& path);
+
+  Shard& ShardOf(const Components& components);
+  Counters& CountersOfThread() const;
+
+  // Evicts workspaces, except the one of `kept`, until none is expired and
+  // the budget is met.
+  void Evict(const Slot* absl_nullable kept);
+
+  // Returns a copy of `node` (or a new node if null) where the node at the
+  // end of the path from `begin` to `end` has `slot`. If `slot` is null, the
+  // nodes left empty are removed, and null is returned if `node` is.
+  static std::shared_ptr<const Node> WithSlot(
+    const Node* absl_nullable node, Components::const_iterator begin,
+    Components::const_iterator end, std::shared_ptr<Slot> slot);
+
+  const Options options_;
+
+  // Serializes the publications of new roots. Readers only load `root_` and
+  // slots with `std::atomic_load`. Locked after a shard, if any.
+  std::mutex root_mutex_;
+  std::shared_ptr<const Node> root_ = std::make_shared<const Node>();
+
+  std::array<Shard, kShards> shards_;
+  // Versions start from the time, so they still increase after a restart.
+  std::atomic<uint64_t> next_version_ =
+    static_cast<uint64_t>(absl::ToUnixMicros(absl::Now()));
+  std::atomic<size_t> bytes_ = 0;
+  std::atomic<uint64_t> evictions_ = 0;
+  // Serializes evictions, which lock the shards one at a time.
+  std::mutex eviction_mutex_;
+
+  mutable std::array<Counters, kShards> counters_;
+
+  // Listeners are called concurrently by the threads adding reports, which
+  // share the lock, while subscribing and unsubscribing take it exclusively.
+  mutable std::shared_mutex listeners_mutex_;
+  mutable std::list<Listener> listeners_;
 };
 
 }  // namespace gimli
@@ -0,0 +1,164 @@
+#include <cstddef>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "gimli/benchmark_testdata.h"
+#include "gimli/report.h"
+#include "gimli/reporter.h"
+
+namespace gimli {
+namespace {
+
+// Path of the workspace `index` with `depth` components, below directories
+// shared by all the workspaces, and grouped by 100 like CI checkouts would.
+std::filesystem::path WorkspacePath(int index, int depth) {
+  std::filesystem::path path = "/";
+  for (int i = 2; i < depth; ++i) {
+    path /= absl::StrCat("dir", i);
+  }
+  return path / absl::StrCat("group", index % 100) /
+         absl::StrCat("workspace", index);
+}
+
+// Benchmarks take the number of workspaces and their depth as arguments.
+void AddReports(Reporter& reporter, const benchmark::State& state) {
+  for (int i = 0; i < state.range(0); ++i) {
+    reporter.AddReport(
+      BenchmarkTestdata::MakeReport(WorkspacePath(i, state.range(1)), 0));
+  }
+}
+
+void BM_AddReport(benchmark::State& state) {
+  Reporter reporter;
+  AddReports(reporter, state);
+  // Reports are made upfront, and copied in batches with the timer paused,
+  // so only adding them is measured.
+  std::vector<Report> made;
+  while (made.size() < 1000) {
+    for (int i = 0; i < state.range(0); ++i) {
+      made.push_back(
+        BenchmarkTestdata::MakeReport(WorkspacePath(i, state.range(1)), 10));
+    }
+  }
+
+  std::vector<Report> reports;
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == 0) {
+      state.PauseTiming();
+      reports = made;
+      state.ResumeTiming();
+    }
+    reporter.AddReport(std::move(reports[i]));
+    i = (i + 1) % reports.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddReport)->ArgsProduct({{1, 10, 100, 1000, 10000}, {2, 8, 32}});
+
+void BM_GetReportFor(benchmark::State& state) {
+  Reporter reporter;
+  AddReports(reporter, state);
+  std::vector<std::filesystem::path> paths;
+  for (int i = 0; i < state.range(0); ++i) {
+    paths.push_back(WorkspacePath(i, state.range(1)) / "some/file.cc");
+  }
+
+  int i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(reporter.GetReportFor(paths[i]));
+    i = (i + 1) % state.range(0);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetReportFor)
+  ->ArgsProduct({{1, 10, 100, 1000, 10000}, {2, 8, 32}});
+
+// Measures copying a report with as many errors as the argument, which is
+// done each time a running build is published, and its memory.
+void BM_CopyReport(benchmark::State& state) {
+  const Report report =
+    BenchmarkTestdata::MakeReport("/some/project", state.range(0));
+  for (auto _ : state) {
+    Report copy = report;
+    benchmark::DoNotOptimize(copy);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["bytes_per_report"] =
+    static_cast<double>(Reporter::ByteSizeOf(Report(report)));
+}
+BENCHMARK(BM_CopyReport)->Range(1, 10000);
+
+// The reporter shared by all the threads of the concurrent benchmarks, and
+// by all their runs. It is never destroyed.
+Reporter& GetSharedReporter() {
+  static auto* const reporter = []() {
+    auto* reporter = new Reporter();
+    for (int i = 0; i < 10000; ++i) {
+      reporter->AddReport(
+        BenchmarkTestdata::MakeReport(WorkspacePath(i, 8), 0));
+    }
+    return reporter;
+  }();
+  return *reporter;
+}
+
+// Threads of the concurrent benchmarks each use their own workspaces, so
+// any contention is within the reporter.
+std::vector<Report> ReportsOfThread(const benchmark::State& state) {
+  std::vector<Report> reports;
+  for (int i = 0; i < 100; ++i) {
+    reports.push_back(BenchmarkTestdata::MakeReport(
+      WorkspacePath(state.thread_index() * 100 + i, 8), 10));
+  }
+  return reports;
+}
+
+void AddReports(benchmark::State& state) {
+  Reporter& reporter = GetSharedReporter();
+  const std::vector<Report> reports = ReportsOfThread(state);
+  size_t i = 0;
+  for (auto _ : state) {
+    reporter.AddReport(reports[i]);
+    i = (i + 1) % reports.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void GetReports(benchmark::State& state) {
+  const Reporter& reporter = GetSharedReporter();
+  std::vector<std::filesystem::path> paths;
+  for (const auto& report : ReportsOfThread(state)) {
+    paths.push_back(report.workspace_path / "some/file.cc");
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(reporter.GetReportFor(paths[i]));
+    i = (i + 1) % paths.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Measures builds of unrelated workspaces publishing concurrently.
+void BM_ConcurrentAddReport(benchmark::State& state) { AddReports(state); }
+BENCHMARK(BM_ConcurrentAddReport)->ThreadRange(1, 64)->UseRealTime();
+
+// Measures editors querying concurrently.
+void BM_ConcurrentGetReportFor(benchmark::State& state) { GetReports(state); }
+BENCHMARK(BM_ConcurrentGetReportFor)->ThreadRange(1, 64)->UseRealTime();
+
+// Measures as many threads publishing as querying, like a shared server.
+void BM_ConcurrentMixed(benchmark::State& state) {
+  if (state.thread_index() % 2 == 0) {
+    AddReports(state);
+  } else {
+    GetReports(state);
+  }
+}
+BENCHMARK(BM_ConcurrentMixed)->ThreadRange(2, 64)->UseRealTime();
+
+}  // namespace
+}  // namespace gimli
@@ -1,20 +1,35 @@
 #include "gimli/reporter.h"
 
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gimli/metrics.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 namespace gimli {
 namespace {
+using ::testing::ElementsAre;
 using ::testing::Eq;
+using ::testing::Field;
+using ::testing::Gt;
 using ::testing::IsEmpty;
+using ::testing::IsNull;
+using ::testing::NotNull;
+using ::testing::Pointee;
 using ::testing::SizeIs;
 
 TEST(ReporterTest, Works) {
   Reporter under_test;
 
   // Initially we have no report.
-  ASSERT_THAT(under_test.GetReportFor("/some/project"), Eq(std::nullopt));
+  ASSERT_THAT(under_test.GetReportFor("/some/project"), IsNull());
 
   // Adding a report will make it available.
   under_test.AddReport({
@@ -37,7 +52,7 @@ TEST(ReporterTest, Works) {
 
   // Check that it's indeed available. Check only a few fields.
   auto report = under_test.GetReportFor("/some/project");
-  ASSERT_TRUE(report.has_value());
+  ASSERT_NE(report, nullptr);
   ASSERT_THAT(report->errors, SizeIs(1));
   auto error = report->errors.front();
   ASSERT_THAT(error.path_in_workspace, Eq("main.cc"));
@@ -47,15 +62,347 @@ TEST(ReporterTest, Works) {
     .workspace_path = "/some/project",
     .time = absl::Now(),
   });
+  auto previous_report = std::move(report);
   report = under_test.GetReportFor("/some/project");
-  ASSERT_TRUE(report.has_value());
+  ASSERT_NE(report, nullptr);
   ASSERT_THAT(report->errors, IsEmpty());
+  // But the previous report is a snapshot, which is unchanged.
+  ASSERT_THAT(previous_report->errors, SizeIs(1));
 
   report = under_test.GetReportFor("/some/project/");
-  ASSERT_TRUE(report.has_value());
+  ASSERT_NE(report, nullptr);
 
   report = under_test.GetReportFor("/some/project/file/under.cc");
-  ASSERT_TRUE(report.has_value());
+  ASSERT_NE(report, nullptr);
+}
+
+TEST(ReporterTest, ReturnsDeepestWorkspace) {
+  Reporter under_test;
+  under_test.AddReport({.workspace_path = "/some/project"});
+  under_test.AddReport({.workspace_path = "/some/project/nested/"});
+  under_test.AddReport({.workspace_path = "/some/other"});
+
+  auto report = under_test.GetReportFor("/some/project/nested/file.cc");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->workspace_path, Eq("/some/project/nested/"));
+
+  report = under_test.GetReportFor("/some/project/nested");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->workspace_path, Eq("/some/project/nested/"));
+
+  report = under_test.GetReportFor("/some/project/nested_not/file.cc");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->workspace_path, Eq("/some/project"));
+
+  report = under_test.GetReportFor("/some/project/../other/file.cc");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->workspace_path, Eq("/some/other"));
+
+  EXPECT_THAT(under_test.GetReportFor("/some"), IsNull());
+  EXPECT_THAT(under_test.GetReportFor("/some/proj"), IsNull());
+}
+
+TEST(ReporterTest, KeepsConcurrentInvocations) {
+  Reporter under_test;
+  const auto kStart = absl::FromUnixSeconds(1764368148);
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "sync",
+    .time = kStart,
+    .status = Report::Status::kRunning,
+  });
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "build",
+    .time = kStart + absl::Seconds(1),
+    .status = Report::Status::kRunning,
+  });
+  // The latest started invocation is the report of the workspace.
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "build")));
+
+  // Completing the earlier invocation doesn't replace the later one.
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "sync",
+    .time = kStart,
+  });
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "build")));
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "build",
+    .time = kStart + absl::Seconds(1),
+    .errors = {{.path_in_workspace = "main.cc"}},
+  });
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "build")));
+
+  // Both invocations can still be gotten, from any path in the workspace.
+  EXPECT_THAT(under_test.GetReportFor("/some/project/main.cc", "sync"),
+              Pointee(Field(&Report::status, Report::Status::kFinished)));
+  EXPECT_THAT(under_test.GetReportFor("/some/project/main.cc", "build"),
+              Pointee(Field(&Report::errors, SizeIs(1))));
+  EXPECT_THAT(under_test.GetReportFor("/some/project", "unknown"), IsNull());
+  EXPECT_EQ(under_test.GetStats().reports, 2);
+}
+
+TEST(ReporterTest, ReturnsCompletedUntilNewerBuildStarts) {
+  Reporter under_test;
+  const auto kStart = absl::FromUnixSeconds(1764368148);
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "first",
+    .time = kStart,
+  });
+  // An invocation which started before the completed one is still running.
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "long",
+    .time = kStart - absl::Seconds(1),
+    .status = Report::Status::kRunning,
+  });
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "first")));
+
+  under_test.AddReport({
+    .workspace_path = "/some/project",
+    .invocation_id = "second",
+    .time = kStart + absl::Seconds(1),
+    .status = Report::Status::kRunning,
+  });
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "second")));
+}
+
+TEST(ReporterTest, DropsOldFinishedInvocations) {
+  Reporter under_test;
+  for (int i = 0; i < 20; ++i) {
+    under_test.AddReport({
+      .workspace_path = "/some/project",
+      .invocation_id = absl::StrCat(i),
+      .time = absl::FromUnixSeconds(i),
+    });
+  }
+  EXPECT_THAT(under_test.GetReportFor("/some/project"),
+              Pointee(Field(&Report::invocation_id, "19")));
+  EXPECT_THAT(under_test.GetReportFor("/some/project", "11"), NotNull());
+  EXPECT_THAT(under_test.GetReportFor("/some/project", "10"), IsNull());
+  EXPECT_EQ(under_test.GetStats().reports, 9);
+}
+
+TEST(ReporterTest, VersionsReports) {
+  Reporter under_test;
+  const absl::Time build_time = absl::Now();
+  Report report{.workspace_path = "/some/project", .time = build_time};
+  report.errors.push_back({.path_in_workspace = "main.cc", .line = 1});
+  under_test.AddReport(report);
+  const auto first = under_test.GetReportFor("/some/project");
+  ASSERT_THAT(first, NotNull());
+  EXPECT_THAT(first->past_versions, IsEmpty());
+
+  // The same build has more errors, so its previous version is kept.
+  report.errors.push_back({.path_in_workspace = "main.cc", .line = 2});
+  under_test.AddReport(report);
+  const auto second = under_test.GetReportFor("/some/project");
+  EXPECT_THAT(second->version, Gt(first->version));
+  ASSERT_THAT(second->past_versions, SizeIs(1));
+  EXPECT_EQ(second->past_versions[0].version, first->version);
+  EXPECT_EQ(second->past_versions[0].errors, 1);
+
+  // Only the latest past versions are kept.
+  for (int i = 0; i < 100; ++i) under_test.AddReport(report);
+  const auto last = under_test.GetReportFor("/some/project");
+  EXPECT_THAT(last->past_versions, SizeIs(Gt(1)));
+  EXPECT_THAT(last->past_versions, SizeIs(testing::Lt(100)));
+  EXPECT_EQ(last->past_versions.back().version + 1, last->version);
+
+  // A new build has no past version.
+  report.time = build_time + absl::Seconds(1);
+  under_test.AddReport(report);
+  const auto next = under_test.GetReportFor("/some/project");
+  EXPECT_THAT(next->version, Gt(last->version));
+  EXPECT_THAT(next->past_versions, IsEmpty());
+}
+
+TEST(ReporterTest, NotifiesSubscribers) {
+  Reporter under_test;
+  std::vector<std::filesystem::path> notified;
+  {
+    auto subscription = under_test.Subscribe(
+      [&](const Report& report) { notified.push_back(report.workspace_path); });
+    under_test.AddReport({.workspace_path = "/some/project"});
+    // Moving the subscription keeps the listener subscribed.
+    auto moved = std::move(subscription);
+    under_test.AddReport({.workspace_path = "/some/other"});
+  }
+  // The subscription is destroyed, so the listener is not called anymore.
+  under_test.AddReport({.workspace_path = "/some/project"});
+  EXPECT_THAT(notified, ElementsAre("/some/project", "/some/other"));
+}
+
+TEST(ReporterTest, SupportsConcurrentReadersAndWriters) {
+  Reporter under_test;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&under_test, i]() {
+      const std::string workspace = absl::StrCat("/some/project", i % 2);
+      for (int j = 0; j < 100; ++j) {
+        under_test.AddReport({.workspace_path = workspace});
+        under_test.AddReport(
+          {.workspace_path = absl::StrCat(workspace, "/", j)});
+      }
+    });
+    threads.emplace_back([&under_test, i]() {
+      for (int j = 0; j < 100; ++j) {
+        auto report = under_test.GetReportFor(
+          absl::StrCat("/some/project", i % 2, "/", j, "/file.cc"));
+        if (report != nullptr) {
+          EXPECT_TRUE(absl::StartsWith(report->workspace_path.native(),
+                                       "/some/project"));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  auto report = under_test.GetReportFor("/some/project1/99/file.cc");
+  ASSERT_NE(report, nullptr);
+  EXPECT_THAT(report->workspace_path, Eq("/some/project1/99"));
+}
+
+TEST(ReporterTest, AccountsBytes) {
+  const Report report{
+    .workspace_path = "/some/project/with/a/path/longer/than/inline/strings",
+    .errors = {{
+      .path_in_workspace = "main.cc",
+      .message = std::string(1000, 'x'),
+      .context = {std::string(100, 'y')},
+    }},
+  };
+  // Measures a copy, like the one added, which has no spare capacity.
+  const size_t bytes = Reporter::ByteSizeOf(Report(report));
+  EXPECT_THAT(bytes, Gt(sizeof(Report) + 1100));
+
+  Reporter under_test;
+  under_test.AddReport(report);
+  under_test.AddReport({.workspace_path = "/other"});
+  auto stats = under_test.GetStats();
+  EXPECT_EQ(stats.reports, 2);
+  EXPECT_EQ(stats.bytes,
+            bytes + Reporter::ByteSizeOf({.workspace_path = "/other"}));
+
+  // Replacing a report accounts for the new one only, with its past version.
+  under_test.AddReport({.workspace_path = "/other", .errors = {{}}});
+  stats = under_test.GetStats();
+  EXPECT_EQ(stats.reports, 2);
+  const auto replaced = under_test.GetReportFor("/other");
+  ASSERT_THAT(replaced->past_versions, SizeIs(1));
+  EXPECT_EQ(stats.bytes, bytes + Reporter::ByteSizeOf(*replaced));
+}
+
+TEST(ReporterTest, EvictsLeastRecentlyUsed) {
+  const size_t bytes = Reporter::ByteSizeOf({.workspace_path = "/first"});
+  Reporter under_test({.max_bytes = 3 * bytes});
+  under_test.AddReport({.workspace_path = "/first"});
+  absl::SleepFor(absl::Milliseconds(20));
+  under_test.AddReport({.workspace_path = "/second"});
+  absl::SleepFor(absl::Milliseconds(20));
+  under_test.AddReport({.workspace_path = "/third"});
+  absl::SleepFor(absl::Milliseconds(20));
+  // Getting a report makes it the most recently used.
+  ASSERT_THAT(under_test.GetReportFor("/first/file.cc"), NotNull());
+  absl::SleepFor(absl::Milliseconds(20));
+
+  // Exceeding the budget evicts down to 7/8 of it, so here two reports.
+  under_test.AddReport({.workspace_path = "/fourth"});
+  EXPECT_THAT(under_test.GetReportFor("/first"), NotNull());
+  EXPECT_THAT(under_test.GetReportFor("/second"), IsNull());
+  EXPECT_THAT(under_test.GetReportFor("/third"), IsNull());
+  EXPECT_THAT(under_test.GetReportFor("/fourth"), NotNull());
+  const auto stats = under_test.GetStats();
+  EXPECT_EQ(stats.evictions, 2);
+  EXPECT_EQ(stats.reports, 2);
+  EXPECT_EQ(stats.bytes, 2 * bytes);
+}
+
+TEST(ReporterTest, KeepsReportLargerThanBudget) {
+  Reporter under_test({.max_bytes = 1});
+  under_test.AddReport({.workspace_path = "/first"});
+  under_test.AddReport({.workspace_path = "/second"});
+  EXPECT_THAT(under_test.GetReportFor("/first"), IsNull());
+  EXPECT_THAT(under_test.GetReportFor("/second"), NotNull());
+}
+
+TEST(ReporterTest, EvictsExpired) {
+  Reporter under_test({.ttl = absl::Milliseconds(50)});
+  under_test.AddReport({.workspace_path = "/some/project"});
+  under_test.AddReport({.workspace_path = "/some/project/nested"});
+  absl::SleepFor(absl::Milliseconds(100));
+  under_test.AddReport({.workspace_path = "/some/other"});
+
+  under_test.Evict();
+  EXPECT_THAT(under_test.GetReportFor("/some/project/nested"), IsNull());
+  EXPECT_THAT(under_test.GetReportFor("/some/other"), NotNull());
+  EXPECT_EQ(under_test.GetStats().evictions, 2);
+
+  // An evicted workspace can be added again.
+  under_test.AddReport({.workspace_path = "/some/project/nested"});
+  EXPECT_THAT(under_test.GetReportFor("/some/project/nested"), NotNull());
+}
+
+TEST(ReporterTest, EvictsConcurrently) {
+  const size_t report_bytes =
+    Reporter::ByteSizeOf({.workspace_path = "/some/project/0/0"});
+  Reporter under_test({.max_bytes = 20 * report_bytes});
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&under_test, i]() {
+      for (int j = 0; j < 100; ++j) {
+        under_test.AddReport(
+          {.workspace_path = absl::StrCat("/some/project/", i, "/", j)});
+        under_test.GetReportFor(absl::StrCat("/some/project/", i, "/", j / 2));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  // The workspaces left are exactly the ones accounted for.
+  const auto stats = under_test.GetStats();
+  EXPECT_LE(stats.bytes, 20 * report_bytes);
+  EXPECT_EQ(stats.evictions, 400 - stats.reports);
+  size_t found = 0;
+  size_t bytes = 0;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 100; ++j) {
+      const auto report = under_test.GetReportFor(
+        absl::StrCat("/some/project/", i, "/", j, "/file.cc"));
+      if (report == nullptr) continue;
+      ++found;
+      bytes += Reporter::ByteSizeOf(*report);
+    }
+  }
+  EXPECT_EQ(found, stats.reports);
+  EXPECT_EQ(bytes, stats.bytes);
+}
+
+TEST(ReporterTest, CountsHitsAndMisses) {
+  Reporter under_test;
+  under_test.AddReport({.workspace_path = "/some/project"});
+  under_test.GetReportFor("/some/project/file.cc");
+  under_test.GetReportFor("/some/project/other.cc");
+  under_test.GetReportFor("/some/other/file.cc");
+  const auto stats = under_test.GetStats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 1);
+}
+
+TEST(ReporterTest, RecordsLockHold) {
+  Histogram lock_hold;
+  Reporter under_test({.lock_hold = &lock_hold});
+  under_test.AddReport({.workspace_path = "/some/project"});
+  under_test.AddReport({.workspace_path = "/some/project"});
+  EXPECT_EQ(lock_hold.GetSnapshot().count, 2);
 }
 
 }  // namespace
@@ -1,48 +1,288 @@
 #include "gimli/stderr_processor.h"
 
-#include <regex>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <utility>
 
-#include "absl/strings/str_split.h"
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/ascii.h"
 
 namespace gimli {
+namespace {
 
-std::vector<std::string> StderrProcessor::ToContents(
-  std::string_view stderr) const {
-  return absl::StrSplit(
-    std::regex_replace(std::string(stderr), ansi_codes_, ""),
-    absl::ByAnyChar("\r\n"), absl::SkipEmpty());
+constexpr char kEscape = '\x1b';
+
+// Returns the memory allocated by `string`, which is none for a short one
+// stored inline.
+size_t HeapBytesOf(const std::string& string) {
+  static const size_t kInlineCapacity = std::string().capacity();
+  return string.capacity() > kInlineCapacity ? string.capacity() + 1 : 0;
+}
+
+bool IsSpecial(char c) { return c == kEscape || c == '\r' || c == '\n'; }
+
+// Returns the position of the first ESC, CR or LF in `text`, or its size if
+// there is none. Most of stderr is plain text, so this is vectorized when the
+// target supports it, with a scalar loop for the remaining bytes.
+size_t FindSpecial(std::string_view text) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i escape32 = _mm256_set1_epi8(kEscape);
+  const __m256i cr32 = _mm256_set1_epi8('\r');
+  const __m256i lf32 = _mm256_set1_epi8('\n');
+  for (; i + sizeof(__m256i) <= text.size(); i += sizeof(__m256i)) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const __m256i chunk = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(&text[i]));
+    const __m256i found = _mm256_or_si256(
+      _mm256_cmpeq_epi8(chunk, escape32),
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr32),
+                      _mm256_cmpeq_epi8(chunk, lf32)));
+    const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+    if (mask != 0) return i + absl::countr_zero(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i escape16 = _mm_set1_epi8(kEscape);
+  const __m128i cr16 = _mm_set1_epi8('\r');
+  const __m128i lf16 = _mm_set1_epi8('\n');
+  for (; i + sizeof(__m128i) <= text.size(); i += sizeof(__m128i)) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const __m128i chunk = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(&text[i]));
+    const __m128i found =
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, escape16),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, cr16),
+                                _mm_cmpeq_epi8(chunk, lf16)));
+    const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+    if (mask != 0) return i + absl::countr_zero(mask);
+  }
+#endif
+  for (; i < text.size(); ++i) {
+    if (IsSpecial(text[i])) return i;
+  }
+  return text.size();
+}
+
+// Returns the size of the ANSI CSI sequence at the start of `text` (which
+// starts with ESC), or 0 if there is none. A sequence is ESC, '[', parameter
+// bytes `[0-9;?]*`, intermediate bytes `[ -/]*` and a final byte `[@-~]`.
+size_t AnsiCodeSize(std::string_view text) {
+  size_t i = 1;
+  if (i == text.size() || text[i] != '[') return 0;
+  ++i;
+  while (i < text.size() &&
+         (absl::ascii_isdigit(text[i]) || text[i] == ';' || text[i] == '?')) {
+    ++i;
+  }
+  while (i < text.size() && text[i] >= ' ' && text[i] <= '/') ++i;
+  if (i == text.size() || text[i] < '@' || text[i] > '~') return 0;
+  return i + 1;
+}
+
+// Consumes the leading decimal digits of `text` into `value`. Returns false if
+// there are none, or if they don't fit in an int.
+bool ConsumeNumber(std::string_view& text, int& value) {
+  size_t size = 0;
+  while (size < text.size() && absl::ascii_isdigit(text[size])) ++size;
+  if (size == 0) return false;
+  const auto [ptr, ec] =
+    std::from_chars(text.data(), text.data() + size, value);
+  if (ec != std::errc()) return false;
+  text.remove_prefix(size);
+  return true;
+}
+
+// Consumes `prefix` at the start of `text`, if present.
+bool ConsumePrefix(std::string_view& text, std::string_view prefix) {
+  if (text.substr(0, prefix.size()) != prefix) return false;
+  text.remove_prefix(prefix.size());
+  return true;
+}
+
+// Parses a line of the form `path:line:column: message`, where `path` contains
+// no colon and `message` is not empty.
+std::optional<Report::Error> ParseErrorBegin(std::string_view line) {
+  const auto colon = line.find(':');
+  if (colon == 0 || colon == std::string_view::npos) return std::nullopt;
+  Report::Error error{.path_in_workspace = line.substr(0, colon)};
+  line.remove_prefix(colon + 1);
+  if (!ConsumeNumber(line, error.line)) return std::nullopt;
+  if (!ConsumePrefix(line, ":")) return std::nullopt;
+  if (!ConsumeNumber(line, error.column)) return std::nullopt;
+  if (!ConsumePrefix(line, ": ")) return std::nullopt;
+  if (line.empty()) return std::nullopt;
+  error.message = line;
+  return error;
+}
+
+// Matches the `N error(s) generated.` line that compilers print at the end of
+// their diagnostics.
+bool IsErrorEnd(std::string_view line) {
+  int count = 0;
+  if (!ConsumeNumber(line, count)) return false;
+  return line == " error generated." || line == " errors generated.";
+}
+
+// Matches the lines that Bazel prints itself, like messages and progress,
+// which end the diagnostics of a compiler. Unlike clang, gcc and rustc don't
+// print an `N errors generated.` line.
+bool IsBazelLine(std::string_view line) {
+  for (std::string_view prefix : {"INFO: ", "WARNING: ", "ERROR: "}) {
+    if (line.substr(0, prefix.size()) == prefix) return true;
+  }
+  // Progress is `[done / total] ...`, with thousands separated by commas.
+  if (!ConsumePrefix(line, "[")) return false;
+  const std::string_view counts = line.substr(0, line.find(']'));
+  return counts.size() < line.size() &&
+         counts.find(" / ") != std::string_view::npos &&
+         counts.find_first_not_of("0123456789, /") == std::string_view::npos;
+}
+
+}  // namespace
+
+void StderrProcessor::ToContents(std::string_view stderr,
+                                 Contents& contents) const {
+  std::string& buffer = contents.buffer_;
+  std::vector<std::string_view>& lines = contents.lines_;
+  buffer.clear();
+  lines.clear();
+  // Stripping only removes bytes, so the buffer never needs to grow past this
+  // and the views into it remain valid while it is filled.
+  buffer.reserve(stderr.size());
+
+  size_t line_begin = 0;
+  const auto end_line = [&]() {
+    if (buffer.size() > line_begin) {
+      lines.push_back(std::string_view(buffer).substr(line_begin));
+    }
+    line_begin = buffer.size();
+  };
+
+  while (!stderr.empty()) {
+    const size_t pos = FindSpecial(stderr);
+    buffer.append(stderr.substr(0, pos));
+    if (pos == stderr.size()) break;
+    stderr.remove_prefix(pos);
+    if (stderr.front() != kEscape) {
+      end_line();
+      stderr.remove_prefix(1);
+      continue;
+    }
+    const size_t size = AnsiCodeSize(stderr);
+    if (size == 0) {
+      // Not a known escape code, so it's kept as is.
+      buffer.push_back(kEscape);
+      stderr.remove_prefix(1);
+      continue;
+    }
+    stderr.remove_prefix(size);
+  }
+  end_line();
 }
 
 std::vector<Report::Error> StderrProcessor::ToErrors(
   std::string_view stderr) const {
+  Stream stream(this);
+  std::vector<Report::Error> errors = stream.Append(stderr);
+  for (auto&& error : stream.Finish()) {
+    errors.push_back(std::move(error));
+  }
+  return errors;
+}
+
+size_t StderrProcessor::Contents::HeapBytes() const {
+  return HeapBytesOf(buffer_) + lines_.capacity() * sizeof(std::string_view);
+}
+
+void StderrProcessor::Contents::Release() {
+  std::string().swap(buffer_);
+  std::vector<std::string_view>().swap(lines_);
+}
+
+std::vector<Report::Error> StderrProcessor::Stream::Append(
+  std::string_view chunk) {
   std::vector<Report::Error> errors;
-  Report::Error* ongoing_error = nullptr;
-
-  auto contents = ToContents(stderr);
-  for (const std::string& line : contents) {
-    std::smatch match;
-    if (std::regex_match(line, match, error_begin_pattern_)) {
-      errors.push_back({
-        .path_in_workspace = match[1].str(),
-        .line = std::stoi(match[2].str()),
-        .column = std::stoi(match[3].str()),
-        .message = match[4].str(),
-      });
-      ongoing_error = &errors.back();
+  const size_t last_end_of_line = chunk.find_last_of("\r\n");
+  if (last_end_of_line == std::string_view::npos) {
+    if (tail_.size() < kMaxLineSize) {
+      tail_.append(chunk.substr(0, kMaxLineSize - tail_.size()));
+    }
+    return errors;
+  }
+  // Avoid copying the chunk when there is no unfinished line to prepend.
+  std::string_view lines = chunk.substr(0, last_end_of_line + 1);
+  if (!tail_.empty()) {
+    tail_.append(lines);
+    lines = tail_;
+  }
+  ProcessLines(lines, errors);
+  tail_.assign(chunk.substr(last_end_of_line + 1, kMaxLineSize));
+  // The tail and the contents grow to the largest chunk, so they are only
+  // kept for the next chunks when it's not much larger than a line.
+  if (tail_.capacity() > kMaxRetainedSize) tail_.shrink_to_fit();
+  if (contents_.HeapBytes() > kMaxRetainedSize) contents_.Release();
+  return errors;
+}
+
+std::vector<Report::Error> StderrProcessor::Stream::Finish() {
+  std::vector<Report::Error> errors;
+  ProcessLines(tail_, errors);
+  tail_.clear();
+  if (ongoing_error_.has_value()) {
+    errors.push_back(*std::move(ongoing_error_));
+    ongoing_error_.reset();
+  }
+  return errors;
+}
+
+size_t StderrProcessor::Stream::HeapBytes() const {
+  size_t bytes = HeapBytesOf(tail_) + contents_.HeapBytes();
+  if (ongoing_error_.has_value()) {
+    bytes += HeapBytesOf(ongoing_error_->path_in_workspace.native()) +
+             HeapBytesOf(ongoing_error_->message) +
+             ongoing_error_->context.capacity() * sizeof(std::string);
+    for (const auto& line : ongoing_error_->context) {
+      bytes += HeapBytesOf(line);
+    }
+  }
+  return bytes;
+}
+
+void StderrProcessor::Stream::ProcessLines(std::string_view lines,
+                                           std::vector<Report::Error>& errors) {
+  processor_->ToContents(lines, contents_);
+  for (std::string_view line : contents_.lines()) {
+    line = line.substr(0, kMaxLineSize);
+    if (auto error = ParseErrorBegin(line); error.has_value()) {
+      if (ongoing_error_.has_value()) {
+        errors.push_back(*std::move(ongoing_error_));
+      }
+      ongoing_error_ = std::move(error);
       continue;
     }
-    if (std::regex_match(line, error_end_pattern_)) {
-      ongoing_error = nullptr;
+    if (IsErrorEnd(line) || IsBazelLine(line)) {
+      if (ongoing_error_.has_value()) {
+        errors.push_back(*std::move(ongoing_error_));
+        ongoing_error_.reset();
+      }
       continue;
     }
-    if (ongoing_error != nullptr) {
-      ongoing_error->context.push_back(line);
+    if (ongoing_error_.has_value() &&
+        ongoing_error_->context.size() < kMaxContextLines) {
+      ongoing_error_->context.emplace_back(line);
       continue;
     }
   }
-  return errors;
 }
 
 }  // namespace gimli
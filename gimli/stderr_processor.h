@@ -1,30 +1,85 @@
 #ifndef GIMLI_STDERR_PROCESSOR_H_
 #define GIMLI_STDERR_PROCESSOR_H_
 
-#include <regex>
+#include <cstddef>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "absl/base/nullability.h"
 #include "gimli/report.h"
 
 namespace gimli {
 
 class StderrProcessor {
  public:
-  std::vector<std::string> ToContents(std::string_view stderr) const;
-  std::vector<Report::Error> ToErrors(std::string_view stderr) const;
+  // Lines of a stderr, without ANSI escape codes and without empty lines. The
+  // lines are views into an internal buffer, which is reused when the same
+  // instance is passed again to `ToContents`, so it is not copyable.
+  class Contents {
+   public:
+    Contents() = default;
+    Contents(const Contents&) = delete;
+    Contents& operator=(const Contents&) = delete;
+
+    const std::vector<std::string_view>& lines() const { return lines_; }
+
+    // Returns the memory allocated by the contents.
+    size_t HeapBytes() const;
+    // Frees the memory allocated by the contents, which are then empty.
+    void Release();
+
+   private:
+    friend class StderrProcessor;
+    std::string buffer_;
+    std::vector<std::string_view> lines_;
+  };
+
+  // Extracts the errors of a stderr received in successive chunks, like Bazel
+  // does with progress events. Lines and errors may straddle chunks: only the
+  // unfinished last line and the ongoing error are kept between chunks.
+  class Stream {
+   public:
+    // What a stream keeps is bounded, even for a stderr without line feeds
+    // or an error followed by endless output: longer lines are truncated,
+    // and an error keeps only its first context lines.
+    static constexpr size_t kMaxLineSize = 4096;
+    static constexpr size_t kMaxContextLines = 64;
+    // Memory kept for the unfinished line, and for the lines of the next
+    // chunk, beyond which it's freed after a chunk.
+    static constexpr size_t kMaxRetainedSize = 4 * kMaxLineSize;
+
+    // The processor's scope must encompass the scope of this object.
+    explicit Stream(const StderrProcessor* absl_nonnull processor)
+      : processor_(processor) {}
 
- private:
-  // Regex explanation:
-  // \x1b     -> Matches the ESC character (ASCII 27)
-  // \[       -> Matches the literal '[' that follows ESC in CSI sequences
-  // [0-9;?]* -> Matches zero or more parameter bytes (digits, semicolons,
-  // question marks) [ -/]* -> Matches zero or more intermediate bytes
-  // [@-~]    -> Matches the final byte (usually a letter like 'm', 'K', etc.)
-  std::regex ansi_codes_{R"(\x1b\[[0-9;?]*[ -/]*[@-~])"};
-  std::regex error_begin_pattern_{R"(^([^:]+?):(\d+):(\d+): (.+)$)"};
-  std::regex error_end_pattern_{R"(1 error generated.)"};
+    // Consumes a chunk, and returns the errors that it completed.
+    std::vector<Report::Error> Append(std::string_view chunk);
+    // Consumes the unfinished line, and returns the ongoing error if any.
+    std::vector<Report::Error> Finish();
+
+    // Returns the memory allocated by what the stream keeps between chunks.
+    size_t HeapBytes() const;
+
+   private:
+    void ProcessLines(std::string_view lines,
+                      std::vector<Report::Error>& errors);
+
+    const StderrProcessor* absl_nonnull processor_;
+    std::string tail_;
+    Contents contents_;
+    std::optional<Report::Error> ongoing_error_;
+  };
+
+  // Strips the ANSI escape codes (CSI sequences) from `stderr` and splits it
+  // into lines, in a single pass. Previous lines in `contents` are discarded.
+  void ToContents(std::string_view stderr, Contents& contents) const;
+  // Extracts the errors from the contents. An error starts with a line of the
+  // form `path:line:column: message`, and all the following lines are its
+  // context, until the next error, a `N error(s) generated.` line, or a line
+  // printed by Bazel itself, like `INFO: ...` or `[n / m] ...`.
+  std::vector<Report::Error> ToErrors(std::string_view stderr) const;
 };
 
 }  // namespace gimli
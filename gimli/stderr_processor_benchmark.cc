@@ -0,0 +1,111 @@
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+#include "gimli/benchmark_testdata.h"
+#include "gimli/report.h"
+#include "gimli/stderr_processor.h"
+
+namespace gimli {
+namespace {
+
+// The implementation of `StderrProcessor` before it was replaced by
+// hand-written scanners, kept here as a baseline.
+std::vector<std::string> RegexToContents(std::string_view stderr) {
+  static const std::regex ansi_codes{R"(\x1b\[[0-9;?]*[ -/]*[@-~])"};
+  return absl::StrSplit(
+    std::regex_replace(std::string(stderr), ansi_codes, ""),
+    absl::ByAnyChar("\r\n"), absl::SkipEmpty());
+}
+
+std::vector<Report::Error> RegexToErrors(std::string_view stderr) {
+  static const std::regex error_begin_pattern{
+    R"(^([^:]+?):(\d+):(\d+): (.+)$)"};
+  static const std::regex error_end_pattern{R"(1 error generated.)"};
+
+  std::vector<Report::Error> errors;
+  Report::Error* ongoing_error = nullptr;
+  for (const std::string& line : RegexToContents(stderr)) {
+    std::smatch match;
+    if (std::regex_match(line, match, error_begin_pattern)) {
+      errors.push_back({
+        .path_in_workspace = match[1].str(),
+        .line = std::stoi(match[2].str()),
+        .column = std::stoi(match[3].str()),
+        .message = match[4].str(),
+      });
+      ongoing_error = &errors.back();
+      continue;
+    }
+    if (std::regex_match(line, error_end_pattern)) {
+      ongoing_error = nullptr;
+      continue;
+    }
+    if (ongoing_error != nullptr) ongoing_error->context.push_back(line);
+  }
+  return errors;
+}
+
+// Benchmarks take the number of copies of the recorded stderr as argument:
+// one copy for a small stderr, and 1000 for a large one.
+using MakeStderr = std::string (*)(int copies);
+
+template <MakeStderr make_stderr>
+void BM_ToContents(benchmark::State& state) {
+  const std::string stderr = make_stderr(state.range(0));
+  StderrProcessor processor;
+  StderrProcessor::Contents contents;
+  for (auto _ : state) {
+    processor.ToContents(stderr, contents);
+    benchmark::DoNotOptimize(contents.lines().data());
+  }
+  state.SetBytesProcessed(state.iterations() * stderr.size());
+}
+BENCHMARK(BM_ToContents<BenchmarkTestdata::Stderr>)->Arg(1)->Arg(1000);
+BENCHMARK(BM_ToContents<BenchmarkTestdata::AnsiHeavyStderr>)
+  ->Arg(1)
+  ->Arg(1000);
+
+template <MakeStderr make_stderr>
+void BM_RegexToContents(benchmark::State& state) {
+  const std::string stderr = make_stderr(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RegexToContents(stderr));
+  }
+  state.SetBytesProcessed(state.iterations() * stderr.size());
+}
+BENCHMARK(BM_RegexToContents<BenchmarkTestdata::Stderr>)->Arg(1)->Arg(1000);
+BENCHMARK(BM_RegexToContents<BenchmarkTestdata::AnsiHeavyStderr>)
+  ->Arg(1)
+  ->Arg(1000);
+
+template <MakeStderr make_stderr>
+void BM_ToErrors(benchmark::State& state) {
+  const std::string stderr = make_stderr(state.range(0));
+  StderrProcessor processor;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(processor.ToErrors(stderr));
+  }
+  state.SetBytesProcessed(state.iterations() * stderr.size());
+}
+BENCHMARK(BM_ToErrors<BenchmarkTestdata::Stderr>)->Arg(1)->Arg(1000);
+BENCHMARK(BM_ToErrors<BenchmarkTestdata::AnsiHeavyStderr>)->Arg(1)->Arg(1000);
+
+template <MakeStderr make_stderr>
+void BM_RegexToErrors(benchmark::State& state) {
+  const std::string stderr = make_stderr(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RegexToErrors(stderr));
+  }
+  state.SetBytesProcessed(state.iterations() * stderr.size());
+}
+BENCHMARK(BM_RegexToErrors<BenchmarkTestdata::Stderr>)->Arg(1)->Arg(1000);
+BENCHMARK(BM_RegexToErrors<BenchmarkTestdata::AnsiHeavyStderr>)
+  ->Arg(1)
+  ->Arg(1000);
+
+}  // namespace
+}  // namespace gimli
@@ -7,6 +7,7 @@ namespace gimli {
 namespace {
 using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
+using ::testing::IsEmpty;
 using ::testing::SizeIs;
 using ::testing::StrEq;
 
@@ -30,8 +31,10 @@ TEST(StderrProcessorTest, Works) {
     "darwin-sandbox\n";
 
   StderrProcessor under_test;
+  StderrProcessor::Contents contents;
+  under_test.ToContents(stderr, contents);
   ASSERT_THAT(
-    under_test.ToContents(stderr),
+    contents.lines(),
     ElementsAreArray({
       R"(ERROR: /Users/xdecoret/gimli/gimli/testdata/BUILD:5:10: Compiling gimli/testdata/non_fatal_error.cc failed: (Exit 1): cc_wrapper.sh failed: error executing CppCompile command (from target //gimli/testdata:non_fatal_error) external/rules_cc++cc_configure_extension+local_config_cc/cc_wrapper.sh -U_FORTIFY_SOURCE -fstack-protector -Wall -Wthread-safety -Wself-assign -Wunused-but-set-parameter -Wno-free-nonheap-object ... (remaining 29 arguments skipped))",
       R"(Use --sandbox_debug to see verbose messages from the sandbox and retain )"
@@ -55,5 +58,169 @@ TEST(StderrProcessorTest, Works) {
                                  }));
 }
 
+TEST(StderrProcessorTest, StripsOnlyAnsiCodes) {
+  const std::string_view stderr =
+    "\033[1;31mred\033[0m\r\n"
+    "\033(B not a CSI\033\n"
+    "\033[12 ?trailing intermediate is not a final byte\n"
+    "\033[0m\n"
+    "a line long enough to cross a vector boundary\033[K at last";
+
+  StderrProcessor under_test;
+  StderrProcessor::Contents contents;
+  under_test.ToContents(stderr, contents);
+  EXPECT_THAT(
+    contents.lines(),
+    ElementsAre("red", "\033(B not a CSI\033",
+                "\033[12 ?trailing intermediate is not a final byte",
+                "a line long enough to cross a vector boundary at last"));
+
+  // The contents can be reused, and previous lines are discarded.
+  under_test.ToContents("\033[1mnew\nlines", contents);
+  EXPECT_THAT(contents.lines(), ElementsAre("new", "lines"));
+}
+
+TEST(StderrProcessorTest, SplitsSeveralErrors) {
+  const std::string_view stderr =
+    "a.cc:1:2: error: first\n"
+    "  context of first\n"
+    "b.cc:30:4: warning: second\n"
+    "  context of second\n"
+    "2 errors generated.\n"
+    "not a context\n";
+
+  StderrProcessor under_test;
+  auto errors = under_test.ToErrors(stderr);
+  ASSERT_THAT(errors, SizeIs(2));
+  EXPECT_EQ(errors[0].path_in_workspace, "a.cc");
+  EXPECT_EQ(errors[0].line, 1);
+  EXPECT_EQ(errors[0].column, 2);
+  EXPECT_EQ(errors[0].message, "error: first");
+  EXPECT_THAT(errors[0].context, ElementsAre("  context of first"));
+  EXPECT_EQ(errors[1].path_in_workspace, "b.cc");
+  EXPECT_EQ(errors[1].line, 30);
+  EXPECT_EQ(errors[1].column, 4);
+  EXPECT_EQ(errors[1].message, "warning: second");
+  EXPECT_THAT(errors[1].context, ElementsAre("  context of second"));
+}
+
+TEST(StderrProcessorTest, IgnoresMalformedErrors) {
+  const std::string_view stderr =
+    ":1:2: no path\n"
+    "a.cc:x:2: no line\n"
+    "a.cc:1: no column\n"
+    "a.cc:1:2:no space\n"
+    "a.cc:1:2: \n"
+    "a.cc:99999999999:2: line overflows\n";
+
+  StderrProcessor under_test;
+  EXPECT_THAT(under_test.ToErrors(stderr), IsEmpty());
+}
+
+TEST(StderrProcessorTest, StreamHandlesErrorsAcrossChunks) {
+  const std::string_view stderr =
+    "\033[1ma.cc:1:2: \033[0merror: first\r\n"
+    "  context of first\n"
+    "b.cc:30:4: warning: second\n"
+    "  context of second\n"
+    "2 errors generated.\n"
+    "not a context\n"
+    "c.cc:5:6: error: unterminated";
+
+  StderrProcessor processor;
+  const auto expected = processor.ToErrors(stderr);
+  ASSERT_THAT(expected, SizeIs(3));
+
+  // Split the stderr at every possible position, including in the middle of
+  // escape codes and end of lines, and check the result is unchanged.
+  for (size_t i = 0; i <= stderr.size(); ++i) {
+    StderrProcessor::Stream under_test(&processor);
+    auto errors = under_test.Append(stderr.substr(0, i));
+    for (auto&& error : under_test.Append(stderr.substr(i))) {
+      errors.push_back(std::move(error));
+    }
+    for (auto&& error : under_test.Finish()) {
+      errors.push_back(std::move(error));
+    }
+    ASSERT_THAT(errors, SizeIs(expected.size())) << "split at " << i;
+    for (size_t j = 0; j < errors.size(); ++j) {
+      EXPECT_EQ(errors[j].path_in_workspace, expected[j].path_in_workspace);
+      EXPECT_EQ(errors[j].line, expected[j].line);
+      EXPECT_EQ(errors[j].column, expected[j].column);
+      EXPECT_EQ(errors[j].message, expected[j].message);
+      EXPECT_EQ(errors[j].context, expected[j].context);
+    }
+  }
+}
+
+TEST(StderrProcessorTest, StreamReturnsErrorsOnceCompleted) {
+  StderrProcessor processor;
+  StderrProcessor::Stream under_test(&processor);
+
+  // The error is still open, as more context may come in the next chunk.
+  EXPECT_THAT(under_test.Append("a.cc:1:2: error: first\n  con"), IsEmpty());
+  EXPECT_THAT(under_test.Append("text\n"), IsEmpty());
+  // The next error completes the first one.
+  auto errors = under_test.Append("b.cc:3:4: error: second\n");
+  ASSERT_THAT(errors, SizeIs(1));
+  EXPECT_EQ(errors[0].message, "error: first");
+  EXPECT_THAT(errors[0].context, ElementsAre("  context"));
+  // Finishing the stream completes the last one.
+  errors = under_test.Finish();
+  ASSERT_THAT(errors, SizeIs(1));
+  EXPECT_EQ(errors[0].message, "error: second");
+  EXPECT_THAT(errors[0].context, IsEmpty());
+}
+
+TEST(StderrProcessorTest, EndsErrorsAtBazelLines) {
+  const std::string_view stderr =
+    "a.cc:1:2: error: first\n"
+    "  context of first\n"
+    "INFO: From Compiling b.cc:\n"
+    "b.cc:3:4: warning: second\n"
+    "[1,023 / 2,048] Compiling c.cc; 1s linux-sandbox\n"
+    "c.cc:5:6: error: third\n"
+    "ERROR: Build did NOT complete successfully\n"
+    "[not progress]\n";
+
+  StderrProcessor under_test;
+  auto errors = under_test.ToErrors(stderr);
+  ASSERT_THAT(errors, SizeIs(3));
+  EXPECT_THAT(errors[0].context, ElementsAre("  context of first"));
+  EXPECT_THAT(errors[1].context, IsEmpty());
+  EXPECT_THAT(errors[2].context, IsEmpty());
+}
+
+TEST(StderrProcessorTest, StreamKeepsBoundedState) {
+  using Stream = StderrProcessor::Stream;
+  StderrProcessor processor;
+  Stream under_test(&processor);
+
+  // A long run of output after an error, with no line ending it, only keeps
+  // the first lines as context.
+  EXPECT_THAT(under_test.Append("a.cc:1:2: error: first\n"), IsEmpty());
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_THAT(under_test.Append("some output of the tool\n"), IsEmpty());
+  }
+  // A line without end only keeps its beginning, even when the line ends.
+  const std::string long_line(10 * Stream::kMaxLineSize, 'x');
+  EXPECT_THAT(under_test.Append("b.cc:3:4: error: "), IsEmpty());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_THAT(under_test.Append(long_line), IsEmpty());
+  }
+  // Until then, what the stream keeps is bounded by the limits.
+  EXPECT_LT(under_test.HeapBytes(), 4 * Stream::kMaxLineSize);
+  auto errors = under_test.Append(long_line + "\n");
+  ASSERT_THAT(errors, SizeIs(1));
+  EXPECT_THAT(errors[0].context, SizeIs(Stream::kMaxContextLines));
+  // Neither is the memory of a chunk much longer than a line kept.
+  EXPECT_LT(under_test.HeapBytes(), 4 * Stream::kMaxLineSize);
+
+  errors = under_test.Finish();
+  ASSERT_THAT(errors, SizeIs(1));
+  EXPECT_EQ(errors[0].path_in_workspace, "b.cc");
+  EXPECT_THAT(errors[0].message, SizeIs(Stream::kMaxLineSize - 10));
+}
+
 }  // namespace
 }  // namespace gimli
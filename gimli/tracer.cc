@@ -0,0 +1,145 @@
+#include "gimli/tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "absl/base/nullability.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+
+namespace gimli {
+namespace {
+
+std::atomic<uint64_t> next_tracer_id = 1;
+
+// Returns `nanos` in microseconds, the unit of trace events.
+std::string Micros(int64_t nanos) {
+  nanos = std::max<int64_t>(nanos, 0);
+  return absl::StrCat(nanos / 1000, ".",
+                      absl::Dec(nanos % 1000, absl::kZeroPad3));
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<Tracer>> Tracer::Create(
+  std::filesystem::path path) {
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    return absl::UnavailableError(
+      absl::StrCat("Cannot create ", path.string()));
+  }
+  return std::unique_ptr<Tracer>(
+    new Tracer(std::move(path), std::move(stream)));
+}
+
+Tracer::Tracer(std::filesystem::path path, std::ofstream stream)
+  : path_(std::move(path)),
+    stream_(std::move(stream)),
+    id_(next_tracer_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+Tracer::~Tracer() {
+  std::scoped_lock lock(mutex_);
+  stream_ << R"({"displayTimeUnit":"ns","traceEvents":[)";
+  const char* separator = "\n";
+  for (const auto& buffer : buffers_) {
+    const int tid = buffer->thread_id;
+    stream_ << separator
+            << absl::StrCat(R"({"ph":"M","name":"thread_name","pid":1,"tid":)",
+                            tid, R"(,"args":{"name":"thread )", tid, R"("}})");
+    separator = ",\n";
+    // Only the spans which weren't overwritten are left.
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    const uint64_t first =
+      written > kSpansPerThread ? written - kSpansPerThread : 0;
+    for (uint64_t i = first; i < written; ++i) {
+      const Event& event = buffer->events[i % kSpansPerThread];
+      if (event.async) {
+        // Async spans are on tracks identified by their category and id.
+        const std::string common =
+          absl::StrCat(R"("name":")", event.name, R"(","cat":")", event.name,
+                       R"(","id":)", event.stream, R"(,"pid":1,"tid":)", tid);
+        stream_ << separator
+                << absl::StrCat(R"({"ph":"b",)", common, R"(,"ts":)",
+                                Micros(event.begin_nanos), "}")
+                << separator
+                << absl::StrCat(R"({"ph":"e",)", common, R"(,"ts":)",
+                                Micros(event.end_nanos), "}");
+      } else {
+        stream_ << separator
+                << absl::StrCat(
+                     R"({"ph":"X","name":")", event.name,
+                     R"(","cat":"gimli","pid":1,"tid":)", tid, R"(,"ts":)",
+                     Micros(event.begin_nanos), R"(,"dur":)",
+                     Micros(event.end_nanos - event.begin_nanos),
+                     R"(,"args":{"stream":)", event.stream, "}}");
+      }
+    }
+  }
+  stream_ << "\n]}\n";
+  stream_.close();
+  if (!stream_) {
+    LOG(ERROR) << "Cannot write the trace to " << path_;
+    return;
+  }
+  LOG(INFO) << "Trace written to " << path_;
+}
+
+void Tracer::AddSpan(const char* absl_nonnull name, Clock::time_point begin,
+                     Clock::time_point end, uint64_t stream) {
+  Add({
+    .name = name,
+    .begin_nanos = NanosOf(begin),
+    .end_nanos = NanosOf(end),
+    .stream = stream,
+    .async = false,
+  });
+}
+
+void Tracer::AddAsyncSpan(const char* absl_nonnull name,
+                          Clock::time_point begin, Clock::time_point end,
+                          uint64_t stream) {
+  Add({
+    .name = name,
+    .begin_nanos = NanosOf(begin),
+    .end_nanos = NanosOf(end),
+    .stream = stream,
+    .async = true,
+  });
+}
+
+void Tracer::Add(Event event) {
+  Buffer& buffer = BufferOfThread();
+  const uint64_t written = buffer.written.load(std::memory_order_relaxed);
+  buffer.events[written % kSpansPerThread] = event;
+  buffer.written.store(written + 1, std::memory_order_release);
+}
+
+Tracer::Buffer& Tracer::BufferOfThread() {
+  // A thread mostly traces for one tracer, so its buffer is cached.
+  thread_local uint64_t cached_id = 0;
+  thread_local Buffer* absl_nullable cached_buffer = nullptr;
+  if (cached_id == id_) return *cached_buffer;
+
+  std::scoped_lock lock(mutex_);
+  const int thread_id = static_cast<int>(buffers_.size()) + 1;
+  cached_buffer =
+    buffers_.emplace_back(std::make_unique<Buffer>(thread_id)).get();
+  cached_id = id_;
+  return *cached_buffer;
+}
+
+int64_t Tracer::NanosOf(Clock::time_point time) const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time - start_)
+    .count();
+}
+
+}  // namespace gimli
@@ -0,0 +1,113 @@
+#ifndef GIMLI_TRACER_H_
+#define GIMLI_TRACER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "absl/base/nullability.h"
+#include "absl/status/statusor.h"
+
+namespace gimli {
+
+// Records spans of time, like the stages of processing an event, and writes
+// them as Chrome trace events, which Perfetto or chrome://tracing load.
+//
+// Each thread records into a ring buffer of its own, without locking, which
+// keeps its most recent spans. Code taking a null tracer records nothing, so
+// tracing costs a pointer check when disabled.
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Records a span of the current thread, from its construction to its
+  // destruction, if `tracer` is not null. `name` must be a literal.
+  class Span {
+   public:
+    Span(Tracer* absl_nullable tracer, const char* absl_nonnull name,
+         uint64_t stream)
+      : tracer_(tracer), name_(name), stream_(stream) {
+      if (tracer_ != nullptr) begin_ = Clock::now();
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+    ~Span() {
+      if (tracer_ != nullptr) {
+        tracer_->AddSpan(name_, begin_, Clock::now(), stream_);
+      }
+    }
+
+   private:
+    Tracer* absl_nullable tracer_;
+    const char* absl_nonnull name_;
+    uint64_t stream_;
+    Clock::time_point begin_;
+  };
+
+  // Creates the file at `path`, or truncates it. The trace is written when
+  // the tracer is destroyed, which must be after the traced threads are done
+  // with it.
+  static absl::StatusOr<std::unique_ptr<Tracer>> Create(
+    std::filesystem::path path);
+
+  ~Tracer();
+
+  // Records a span of the current thread, for `stream`. `name` must be a
+  // literal.
+  void AddSpan(const char* absl_nonnull name, Clock::time_point begin,
+               Clock::time_point end, uint64_t stream);
+
+  // Records a span which is not bound to a thread, like waiting for a read.
+  // Spans of the same `name` and `stream` are shown on a track of their own,
+  // so they must not overlap.
+  void AddAsyncSpan(const char* absl_nonnull name, Clock::time_point begin,
+                    Clock::time_point end, uint64_t stream);
+
+  // Spans kept per thread, after which the oldest are overwritten.
+  static constexpr size_t kSpansPerThread = 1 << 14;
+
+ private:
+  struct Event {
+    const char* name = "";
+    int64_t begin_nanos = 0;
+    int64_t end_nanos = 0;
+    uint64_t stream = 0;
+    bool async = false;
+  };
+
+  // The ring buffer of a thread, which only that thread writes to.
+  struct Buffer {
+    explicit Buffer(int thread_id) : thread_id(thread_id) {}
+
+    const int thread_id;
+    std::vector<Event> events = std::vector<Event>(kSpansPerThread);
+    std::atomic<uint64_t> written = 0;
+  };
+
+  Tracer(std::filesystem::path path, std::ofstream stream);
+
+  void Add(Event event);
+  // Returns the buffer of the current thread, which is created on its first
+  // span.
+  Buffer& BufferOfThread();
+  int64_t NanosOf(Clock::time_point time) const;
+
+  const std::filesystem::path path_;
+  std::ofstream stream_;
+  const Clock::time_point start_ = Clock::now();
+  // Distinguishes the tracers in the cache of the buffer of each thread.
+  const uint64_t id_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_TRACER_H_
@@ -0,0 +1,90 @@
+#include "gimli/tracer.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "absl/status/status_matchers.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gimli {
+namespace {
+using ::absl_testing::IsOk;
+using ::testing::HasSubstr;
+using ::testing::Not;
+using ::testing::StartsWith;
+
+std::string ContentsOf(const std::filesystem::path& path) {
+  std::ifstream stream(path);
+  std::stringstream contents;
+  contents << stream.rdbuf();
+  return contents.str();
+}
+
+size_t CountOf(const std::string& text, const std::string& pattern) {
+  size_t count = 0;
+  for (size_t i = text.find(pattern); i != std::string::npos;
+       i = text.find(pattern, i + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(TracerTest, WritesChromeTraceEvents) {
+  const auto path = std::filesystem::path(testing::TempDir()) / "spans.json";
+  {
+    auto tracer = Tracer::Create(path);
+    ASSERT_THAT(tracer, IsOk());
+    const auto begin = Tracer::Clock::now();
+    (*tracer)->AddSpan("unpack", begin, begin + std::chrono::microseconds(3),
+                       /*stream=*/7);
+    (*tracer)->AddAsyncSpan("read", begin, begin + std::chrono::seconds(1),
+                            /*stream=*/7);
+    std::thread([&tracer]() {
+      Tracer::Span span(tracer->get(), "publish", /*stream=*/8);
+    }).join();
+  }
+
+  const std::string trace = ContentsOf(path);
+  EXPECT_THAT(trace, StartsWith(R"({"displayTimeUnit":"ns","traceEvents":[)"));
+  EXPECT_THAT(trace, HasSubstr(R"("ph":"X","name":"unpack")"));
+  EXPECT_THAT(trace, HasSubstr(R"("dur":3.000,"args":{"stream":7}})"));
+  EXPECT_THAT(trace,
+              HasSubstr(R"({"ph":"b","name":"read","cat":"read","id":7)"));
+  EXPECT_THAT(trace,
+              HasSubstr(R"({"ph":"e","name":"read","cat":"read","id":7)"));
+  // Each thread has its own buffer.
+  EXPECT_THAT(trace, HasSubstr(R"("name":"publish","cat":"gimli","pid":1,)"
+                               R"("tid":2)"));
+  EXPECT_EQ(CountOf(trace, "thread_name"), 2);
+}
+
+TEST(TracerTest, KeepsMostRecentSpans) {
+  const auto path = std::filesystem::path(testing::TempDir()) / "ring.json";
+  {
+    auto tracer = Tracer::Create(path);
+    ASSERT_THAT(tracer, IsOk());
+    const auto begin = Tracer::Clock::now();
+    for (size_t i = 0; i < Tracer::kSpansPerThread + 10; ++i) {
+      (*tracer)->AddSpan("process", begin, begin, /*stream=*/i);
+    }
+  }
+
+  const std::string trace = ContentsOf(path);
+  EXPECT_EQ(CountOf(trace, R"("name":"process")"), Tracer::kSpansPerThread);
+  EXPECT_THAT(trace, Not(HasSubstr(R"("stream":9})")));
+  EXPECT_THAT(trace, HasSubstr(absl::StrCat(R"("stream":)",
+                                            Tracer::kSpansPerThread + 9, "}")));
+}
+
+TEST(TracerTest, FailsToCreateInMissingDirectory) {
+  EXPECT_FALSE(Tracer::Create("/not/existing/trace.json").ok());
+}
+
+}  // namespace
+}  // namespace gimli
@@ -0,0 +1,81 @@
+#include "gimli/worker_pool.h"
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "absl/log/check.h"
+
+namespace gimli {
+
+void WorkerPool::Sequence::Post(Task task) {
+  {
+    std::scoped_lock lock(mutex_);
+    tasks_.push_back(std::move(task));
+    if (scheduled_) return;
+    scheduled_ = true;
+  }
+  pool_->Schedule(shared_from_this());
+}
+
+WorkerPool::WorkerPool(int num_threads) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() { Work(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  ready_or_stopping_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+std::shared_ptr<WorkerPool::Sequence> WorkerPool::NewSequence() {
+  // The constructor is private, so `std::make_shared` can't be used.
+  return std::shared_ptr<Sequence>(new Sequence(this));
+}
+
+void WorkerPool::Schedule(std::shared_ptr<Sequence> sequence) {
+  {
+    std::scoped_lock lock(mutex_);
+    ready_.push_back(std::move(sequence));
+  }
+  ready_or_stopping_.notify_one();
+}
+
+void WorkerPool::Work() {
+  while (true) {
+    std::shared_ptr<Sequence> sequence;
+    {
+      std::unique_lock lock(mutex_);
+      ready_or_stopping_.wait(lock,
+                              [&]() { return stopping_ || !ready_.empty(); });
+      // A running task may still post, and schedule its sequence, but only
+      // while a thread runs it, which then stays around to pick it up.
+      if (ready_.empty()) return;
+      sequence = std::move(ready_.front());
+      ready_.pop_front();
+    }
+    Task task;
+    {
+      std::scoped_lock lock(sequence->mutex_);
+      task = std::move(sequence->tasks_.front());
+      sequence->tasks_.pop_front();
+    }
+    std::move(task)();
+    {
+      std::scoped_lock lock(sequence->mutex_);
+      if (sequence->tasks_.empty()) {
+        sequence->scheduled_ = false;
+        continue;
+      }
+    }
+    Schedule(std::move(sequence));
+  }
+}
+
+}  // namespace gimli
@@ -0,0 +1,63 @@
+#ifndef GIMLI_WORKER_POOL_H_
+#define GIMLI_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "absl/base/nullability.h"
+#include "absl/functional/any_invocable.h"
+
+namespace gimli {
+
+// Runs tasks on a fixed number of threads.
+//
+// Tasks are posted to sequences: the tasks of a sequence run one after the
+// other, in the order they were posted, while different sequences run
+// concurrently. Sequences take turns, one task at a time, so a busy sequence
+// can't starve the others.
+class WorkerPool {
+ public:
+  using Task = absl::AnyInvocable<void() &&>;
+
+  class Sequence : public std::enable_shared_from_this<Sequence> {
+   public:
+    // Runs `task` after all tasks previously posted to this sequence.
+    void Post(Task task);
+
+   private:
+    friend class WorkerPool;
+    explicit Sequence(WorkerPool* absl_nonnull pool) : pool_(pool) {}
+
+    WorkerPool* absl_nonnull pool_;
+    std::mutex mutex_;
+    std::deque<Task> tasks_;
+    // Whether the sequence is in the pool's queue, or being run.
+    bool scheduled_ = false;
+  };
+
+  // Tasks would never run without threads, so `num_threads` must be positive.
+  explicit WorkerPool(int num_threads);
+  // Runs all the pending tasks, including those they post, then joins.
+  ~WorkerPool();
+
+  // A sequence can outlive the pool, but no task must be posted to it then.
+  std::shared_ptr<Sequence> NewSequence();
+
+ private:
+  void Schedule(std::shared_ptr<Sequence> sequence);
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable ready_or_stopping_;
+  std::deque<std::shared_ptr<Sequence>> ready_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace gimli
+
+#endif  // GIMLI_WORKER_POOL_H_
@@ -0,0 +1,78 @@
+#include "gimli/worker_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gimli {
+namespace {
+using ::testing::ElementsAre;
+using ::testing::SizeIs;
+
+TEST(WorkerPoolTest, RunsSequenceInOrder) {
+  std::vector<int> values;
+  {
+    WorkerPool pool(4);
+    auto sequence = pool.NewSequence();
+    for (int i = 0; i < 1000; ++i) {
+      // No lock: tasks of a sequence never run concurrently.
+      sequence->Post([&values, i]() { values.push_back(i); });
+    }
+  }
+  ASSERT_THAT(values, SizeIs(1000));
+  for (int i = 0; i < 1000; ++i) EXPECT_EQ(values[i], i);
+}
+
+TEST(WorkerPoolTest, RunsSequencesConcurrently) {
+  WorkerPool pool(2);
+  auto blocked = pool.NewSequence();
+  auto other = pool.NewSequence();
+  absl::Notification unblock;
+  absl::Notification done;
+  blocked->Post([&]() { unblock.WaitForNotification(); });
+  other->Post([&]() { done.Notify(); });
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  unblock.Notify();
+}
+
+TEST(WorkerPoolTest, RunsTasksPostedWhileStopping) {
+  std::mutex mutex;
+  std::vector<int> values;
+  {
+    WorkerPool pool(1);
+    auto first = pool.NewSequence();
+    auto second = pool.NewSequence();
+    // The sequences are destroyed before the pool, so captured by value.
+    first->Post([&, second]() {
+      second->Post([&]() {
+        std::scoped_lock lock(mutex);
+        values.push_back(2);
+      });
+      std::scoped_lock lock(mutex);
+      values.push_back(1);
+    });
+  }
+  EXPECT_THAT(values, ElementsAre(1, 2));
+}
+
+TEST(WorkerPoolTest, RunsTasksOfAllSequences) {
+  std::atomic<int> count = 0;
+  {
+    WorkerPool pool(4);
+    std::vector<std::shared_ptr<WorkerPool::Sequence>> sequences;
+    for (int i = 0; i < 10; ++i) sequences.push_back(pool.NewSequence());
+    for (int i = 0; i < 1000; ++i) {
+      sequences[i % sequences.size()]->Post([&count]() { ++count; });
+    }
+  }
+  EXPECT_EQ(count, 1000);
+}
+
+}  // namespace
+}  // namespace gimli